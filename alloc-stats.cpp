@@ -0,0 +1,33 @@
+#include "config.h"
+
+#include "alloc-stats.hpp"
+
+#include <cstdlib>
+#include <new>
+
+size_t allocCount = 0;
+size_t allocBytes = 0;
+
+#ifdef WITH_ALLOC_STATS
+void* operator new(size_t size)
+{
+    ++allocCount;
+    allocBytes += size;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+#endif
@@ -0,0 +1,14 @@
+/**
+ * @brief Heap allocations counter.
+ *
+ * With the alloc-stats build option the global operator new/delete are
+ * replaced with the counting ones, otherwise the counters stay zero.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+// Heap allocations made by the process and their total size
+extern size_t allocCount;
+extern size_t allocBytes;
@@ -0,0 +1,188 @@
+/**
+ * @brief Histogram of the watched sensors values.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief HDR-style histogram of the sensor values.
+ *
+ * Values are counted with the 0.01 resolution in log-linear buckets of the
+ * magnitude: each power of two range is split into 64 sub-buckets, so the
+ * relative error is below 1.6%. Negative values have their own buckets of
+ * the same layout. The counters arrays are fixed (about 11 KiB) and
+ * inserting is O(1). Values beyond the range are counted in the edge
+ * buckets, exact min and max are kept aside.
+ */
+class ValueHistogram
+{
+  public:
+    /**
+     * @brief Account the value
+     */
+    void add(double value)
+    {
+        const double units = std::fabs(value) / RESOLUTION;
+        const uint64_t num = units >= static_cast<double>(1ull << MAX_BITS)
+                                 ? (1ull << MAX_BITS) - 1
+                                 : static_cast<uint64_t>(units);
+        if (value < 0)
+        {
+            ++negative[index(num)];
+        }
+        else
+        {
+            ++positive[index(num)];
+        }
+        if (!total || value < min)
+        {
+            min = value;
+        }
+        if (!total || value > max)
+        {
+            max = value;
+        }
+        ++total;
+        sum += value;
+    }
+
+    /**
+     * @brief Number of accounted values
+     */
+    uint64_t count() const
+    {
+        return total;
+    }
+
+    double minimum() const
+    {
+        return min;
+    }
+
+    double maximum() const
+    {
+        return max;
+    }
+
+    double mean() const
+    {
+        return total ? sum / total : 0;
+    }
+
+    /**
+     * @brief Get the value at the percentile
+     *
+     * @param percentile - Percentile, 0-100
+     *
+     * @return the highest value equivalent to the bucket of the percentile
+     */
+    double percentile(double percentile) const
+    {
+        const uint64_t rank = std::max<uint64_t>(
+            1, static_cast<uint64_t>(std::ceil(percentile / 100 * total)));
+        uint64_t seen = 0;
+        // Negative values ascend from the largest magnitude
+        for (size_t i = COUNTS; i-- > 0;)
+        {
+            seen += negative[i];
+            if (seen >= rank)
+            {
+                return std::clamp(0 - lowest(i) * RESOLUTION, min, max);
+            }
+        }
+        for (size_t i = 0; i < COUNTS; ++i)
+        {
+            seen += positive[i];
+            if (seen >= rank)
+            {
+                return std::clamp(highest(i) * RESOLUTION, min, max);
+            }
+        }
+        return max;
+    }
+
+    /**
+     * @brief Call the function for each non-empty bucket in ascending order
+     *
+     * @param func - Function called with the bucket's lowest value and count
+     */
+    template <typename Func>
+    void forEachBucket(Func func) const
+    {
+        for (size_t i = COUNTS; i-- > 0;)
+        {
+            if (negative[i])
+            {
+                func(-((highest(i) + 1) * RESOLUTION), negative[i]);
+            }
+        }
+        for (size_t i = 0; i < COUNTS; ++i)
+        {
+            if (positive[i])
+            {
+                func(lowest(i) * RESOLUTION, positive[i]);
+            }
+        }
+    }
+
+  private:
+    // Value of the lowest unit
+    static constexpr double RESOLUTION = 0.01;
+    // Size of the linear region, each next power of two range is split into
+    // half of that sub-buckets
+    static constexpr unsigned SUB_BITS = 7;
+    static constexpr uint64_t SUB_COUNT = 1ull << SUB_BITS;
+    static constexpr uint64_t HALF_COUNT = SUB_COUNT / 2;
+    // Magnitudes range in units: [0, 2^MAX_BITS)
+    static constexpr unsigned MAX_BITS = 27;
+    static constexpr size_t COUNTS = (MAX_BITS - SUB_BITS + 2) * HALF_COUNT;
+
+    static size_t index(uint64_t units)
+    {
+        if (units < SUB_COUNT)
+        {
+            return units;
+        }
+        // Position of the most significant bit
+        unsigned msb = 0;
+        while (units >> (msb + 1))
+        {
+            ++msb;
+        }
+        const unsigned shift = msb - SUB_BITS + 1;
+        return (shift + 1) * HALF_COUNT + (units >> shift) - HALF_COUNT;
+    }
+
+    static uint64_t lowest(size_t index)
+    {
+        if (index < SUB_COUNT)
+        {
+            return index;
+        }
+        const unsigned shift = index / HALF_COUNT - 1;
+        return (index % HALF_COUNT + HALF_COUNT) << shift;
+    }
+
+    static uint64_t highest(size_t index)
+    {
+        if (index < SUB_COUNT)
+        {
+            return index;
+        }
+        const unsigned shift = index / HALF_COUNT - 1;
+        return lowest(index) + (1ull << shift) - 1;
+    }
+
+    // Buckets of the magnitudes of the values at or above zero and below
+    uint32_t positive[COUNTS] = {};
+    uint32_t negative[COUNTS] = {};
+    uint64_t total = 0;
+    double sum = 0;
+    double min = 0;
+    double max = 0;
+};
@@ -1,309 +1,232 @@
 #include "config.h"
 
+#include "alloc-stats.hpp"
+#include "histogram.hpp"
+#include "lssensors-private.hpp"
+
+#include <fnmatch.h>
 #include <getopt.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <systemd/sd-event.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
 #include <cmath>
+#include <csignal>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <set>
+#include <stdexcept>
 #include <sdbusplus/bus.hpp>
+#include <sdbusplus/bus/match.hpp>
 #include <sdbusplus/exception.hpp>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 
-// Bus handler singleton
-static sdbusplus::bus::bus systemBus = sdbusplus::bus::new_default();
-static bool useColors = false;
-
-using PropertyValue = std::variant<int64_t, std::string, bool, double>;
-using PropertyName = std::string;
-using PropertiesMap = std::map<PropertyName, PropertyValue>;
+using namespace lssensors;
 
-static constexpr auto SYSTEMD_PROPERTIES = "org.freedesktop.DBus.Properties";
+static bool useColors = false;
+// Show the inventory item column
+static bool showInventory = false;
+// Stream sensors data in the binary format instead of the text tables
+static bool binaryOutput = false;
+// Running as the agent for the remote host
+static bool agentMode = false;
+// Print the bus load statistics
+static bool showStats = false;
+// Print the heap allocations per phase
+static bool showAllocStats = false;
+// Keep the data across runs in CACHE_DIR
+static bool useCache = CACHE_DIR[0] != '\0';
+// Remote host the bus is connected to, the caches are kept per host
+static std::string cacheHost;
+// Backoff of asking the unavailable sensors, us
+static constexpr uint64_t NEGATIVE_MIN_DELAY = 10000000;
+static constexpr uint64_t NEGATIVE_MAX_DELAY = 600000000;
+// Backoff between the listings, which don't see the sensors coming back, us
+static constexpr uint64_t LISTING_NEGATIVE_MIN_DELAY = 1000000;
+static constexpr uint64_t LISTING_NEGATIVE_MAX_DELAY = 5000000;
+// Cache file of the unavailable sensors
+static constexpr auto NEGATIVE_CACHE = "negative";
+// Static properties lifetime, us
+static constexpr uint64_t METADATA_TTL = 60000000;
+// Cache file of the static properties
+static constexpr auto METADATA_CACHE = "metadata";
+// Watch interval range of the interactive commands, us
+static constexpr uint64_t MIN_INTERVAL = 1000;
+static constexpr uint64_t MAX_INTERVAL = 3600000000;
 
 /**
- * @brief Gives a simple access to sensor properties.
+ * @brief Heap allocations made during the phase of the work
  */
-class Properties : public PropertiesMap
+class AllocPhase
 {
   public:
-    using PropertiesMap::PropertiesMap;
-
-    /**
-     * @brief Check if sensor Available and Functional
-     */
-    std::string functional() const
+    AllocPhase()
     {
-        std::string ret = "OK";
-        auto it = this->find("Functional");
-        if (it != this->end() && std::get<bool>(it->second) == false)
-        {
-            ret = "FAIL";
-        }
-        it = this->find("Available");
-        if (it != this->end() && std::get<bool>(it->second) == false)
-        {
-            ret = "N/A";
-        }
-
-        return ret;
+        reset();
     }
 
     /**
-     * @brief Current sensor state
+     * @brief Print the allocations since the previous report
+     *
+     * @param name - Phase name
      */
-    std::string status() const
+    void report(const char* name)
     {
-        std::string ret = functional();
-        if ("OK" == ret)
+        if (!showAllocStats)
         {
-            if (getBool("FatalAlarmHigh"))
-            {
-                ret = "Fatal";
-            }
-            else if (getBool("CriticalAlarmLow") || getBool("CriticalAlarmHigh"))
-            {
-                ret = "Critical";
-            }
-            else if (getBool("WarningAlarmLow") || getBool("WarningAlarmHigh"))
-            {
-                ret = "Warning";
-            }
+            return;
         }
-
-        return ret;
+        // Take the counters before printing, stdio may allocate too
+        const size_t count = allocCount - startCount;
+        const size_t bytes = allocBytes - startBytes;
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        fprintf(stderr,
+                "Alloc: %-9s %8zu allocations %10zu bytes, max RSS %ld "
+                "KiB\n",
+                name, count, bytes, usage.ru_maxrss);
+        reset();
     }
 
-    /**
-     * @brief Sensor's scale factor
-     */
-    float scale() const
+  private:
+    void reset()
     {
-        float ret = 1.f;
-        auto it = this->find("Scale");
-        if (it != this->end())
-        {
-            auto value = std::get<int64_t>(it->second);
-            ret = powf(10, static_cast<float>(value));
-        }
-        return ret;
+        startCount = allocCount;
+        startBytes = allocBytes;
     }
 
-    std::string value() const
-    {
-        if ("OK" != functional())
-        {
-            return "N/A";
-        }
+    size_t startCount;
+    size_t startBytes;
+};
+
+/**
+ * @brief Per-type summary of the listing
+ */
+enum class Summary
+{
+    // Only the tables
+    none,
+    // Only the summary
+    only,
+    // The tables followed by the summary
+    footer,
+};
+static Summary showSummary = Summary::none;
+// Z-score to report the watched value as anomalous (0 - disabled)
+static double anomalyThreshold = 0;
+// Number of samples the anomaly detector averages over
+static unsigned anomalyWindow = 60;
+// Number of samples to predict the thresholds crossing from (0 - disabled)
+static unsigned predictWindow = 0;
+// Longest predicted time to show, seconds
+static unsigned predictHorizon = 600;
 
-        std::string ret(getValue("Value"));
-        if (useColors)
+/**
+ * @brief Format the sensor value, colored by its state if enabled
+ *
+ * @param props - Sensor's properties
+ */
+static std::string formatValue(const Properties& props)
+{
+    std::string ret(props.value());
+    if (useColors && "OK" == props.functional())
+    {
+        switch (props.state())
         {
-            std::string state = status();
-            if (state == "Warning")
-            {
+            case Status::warning:
                 // mark Orange
                 ret = "\033[0;33m" + ret + "\033[0m";
-            }
-            else if (state == "Critical")
-            {
+                break;
+            case Status::critical:
                 // mark Red
                 ret = "\033[0;31m" + ret + "\033[0m";
-            }
-            else if (state == "Fatal")
-            {
+                break;
+            case Status::fatal:
                 // mark Blinking Red
                 ret = "\033[0;31;5m" + ret + "\033[0m";
-            }
-        }
-        return ret;
-    }
-    std::string criticalLow() const
-    {
-        return getValue("CriticalLow");
-    }
-    std::string criticalHigh() const
-    {
-        return getValue("CriticalHigh");
-    }
-    std::string warningLow() const
-    {
-        return getValue("WarningLow");
-    }
-    std::string warningHigh() const
-    {
-        return getValue("WarningHigh");
-    }
-    std::string fatalHigh() const
-    {
-        return getValue("FatalHigh");
-    }
-
-    /**
-     * @brief Short sensors unit name
-     */
-    std::string unit() const
-    {
-        std::string ret;
-
-        auto it = this->find("Unit");
-        if (it != this->end())
-        {
-            auto name = std::get<std::string>(it->second);
-            name = name.substr(name.rfind('.') + 1);
-
-            if ("Volts" == name)
-            {
-                ret = "V";
-            }
-            else if ("DegreesC" == name)
-            {
-                // The degrees character takes two bytes, but only one place
-                // on the screen. It breaks the alignment.
-                // Force fit the string to 3 screen characters long.
-                ret = "°C ";
-            }
-            else if ("Amperes" == name)
-            {
-                ret = "A";
-            }
-            else if ("RPMS" == name)
-            {
-                ret = "RPM";
-            }
-            else if ("Watts" == name)
-            {
-                ret = "W";
-            }
-            else if ("Joules" == name)
-            {
-                ret = "J";
-            }
-            else if ("Meters" == name)
-            {
-                ret = "m";
-            }
-            else if ("Percent" == name)
-            {
-                ret = "%";
-            }
-            else
-            {
-                ret = name;
-            }
+                break;
+            default:
+                break;
         }
-
-        return ret;
     }
+    return ret;
+}
 
-  protected:
-    /**
-     * @brief Check is the specified boolean property has true value
-     *
-     * @param name - Property name
-     */
-    bool getBool(const PropertyName& name) const
-    {
-        auto it = this->find(name);
-        return (it == this->end() ? false : std::get<bool>(it->second));
-    }
+// Type of the last shown sensor, the group header is shown on change
+static std::string shownType;
 
-    /**
-     * @brief Format a sensor value or threshold
-     *
-     * @param name - Property name
-     *
-     * @return String with formatted value of property
-     */
-    std::string getValue(const PropertyName& name) const
+/**
+ * @brief Show the aggregated sensors data, one line per type
+ *
+ * @param summaries - Per-type aggregates
+ */
+static void printSummary(const std::vector<TypeSummary>& summaries)
+{
+    for (const auto& sum : summaries)
     {
-        std::string ret(8, '\0');
-        auto it = this->find(name);
-        if (it == this->end())
-        {
-            ret = "N/A";
-        }
-        else if (std::holds_alternative<double>(it->second))
+        printf("%s: %zu sensor%s", sum.type.c_str(), sum.count,
+               sum.count == 1 ? "" : "s");
+        if (sum.readings)
         {
-            auto value = std::get<double>(it->second);
-            if (std::isnan(value))
-            {
-                ret = "N/A";
-            }
-            else if (value < 1000)
-            {
-                const size_t len =
-                    snprintf(ret.data(), ret.size(), "%7.03f", value);
-                ret.resize(len);
-            }
-            else
-            {
-                const size_t len =
-                    snprintf(ret.data(), ret.size(), "%7d", (int)(value));
-                ret.resize(len);
-            }
+            const char* unit = sum.unit.c_str();
+            printf(", min %.2f %s, max %.2f %s, mean %.2f %s", sum.min, unit,
+                   sum.max, unit, sum.sum / sum.readings, unit);
         }
-        else
+        for (size_t i = 0; i < STATUS_COUNT; ++i)
         {
-            auto factor = scale();
-            auto value = std::get<int64_t>(it->second);
-            if (factor < 1.f)
-            {
-                const size_t len =
-                    snprintf(ret.data(), ret.size(), "%7.03f", value * factor);
-                ret.resize(len);
-            }
-            else
+            const auto state = static_cast<Status>(i);
+            if (state != Status::ok && sum.states[i])
             {
-                const size_t len = snprintf(ret.data(), ret.size(), "%7d",
-                                            (int)(value * factor));
-                ret.resize(len);
+                printf(", %zu %s", sum.states[i], statusName(state));
             }
         }
-        return ret;
+        printf("\n");
     }
-};
+}
 
 /**
  * @brief Show sensor's data
  *
- * @param service - Sensor's object service
- * @param path - Sensor's object path
+ * @param sample - Sensor's properties snapshot
  */
-void printSensorData(const std::string& service, const std::string& path)
+static void printSensorData(const Sample& sample)
 {
-    // Ask DBus for all sensors properties
-    auto m = systemBus.new_method_call(service.c_str(), path.c_str(),
-                                       SYSTEMD_PROPERTIES, "GetAll");
-    m.append("");
-    auto r = systemBus.call(m);
-
-    if (r.is_method_error())
-    {
-        fprintf(stderr, "Get properties for %s failed\n", path.c_str());
-        return;
-    }
-
-    Properties props;
-    r.read(props);
+    const std::string& path = sample.path;
+    const Properties& props = sample.props;
 
     size_t name_pos = path.rfind('/');
     size_t folder_pos = path.rfind('/', name_pos - 1);
 
     // row format string, limit sensor name to 19 characters
-    constexpr auto row_fmt = "%-19.19s %8s %7s %-3s %7s %7s %7s %7s %7s\n";
+    constexpr auto row_fmt = "%-19.19s %8s %7s %-3s %7s %7s %7s %7s %7s";
     // header format, let the Unit column header overlap the LC column a bit
-    constexpr auto hdr_fmt = "%-19.19s %8s %7s %-4s%7s %7s %7s %7s %7s\n";
+    constexpr auto hdr_fmt = "%-19.19s %8s %7s %-4s%7s %7s %7s %7s %7s";
 
     // Show group header if it is a new type
-    static std::string typeName;
-
     std::string currentType =
         path.substr(folder_pos + 1, name_pos - folder_pos - 1);
-    if (typeName != currentType)
+    if (shownType != currentType)
     {
-        if (!typeName.empty())
+        if (!shownType.empty())
         {
             printf("\n");
         }
@@ -311,232 +234,3587 @@ void printSensorData(const std::string& service, const std::string& path)
         printf("=== %s ===\n", currentType.c_str());
         printf(hdr_fmt, "Name", "Status", "Value", "Unit", "LC", "LNC", "UNC",
                "UC", "NR");
-        printf("\n");
+        printf(showInventory ? " Inventory\n\n" : "\n\n");
 
-        typeName = currentType;
+        shownType = currentType;
     }
 
-    // Show sensor data
-    printf(row_fmt, path.c_str() + name_pos + 1, props.status().c_str(),
-           props.value().c_str(), props.unit().c_str(),
+    // Show sensor data, the sensors not asked are marked
+    std::string status = props.status();
+    if (props.count(CACHED_PROPERTY))
+    {
+        status += '*';
+    }
+    printf(row_fmt, path.c_str() + name_pos + 1, status.c_str(),
+           formatValue(props).c_str(), props.unit().c_str(),
            props.criticalLow().c_str(), props.warningLow().c_str(),
            props.warningHigh().c_str(), props.criticalHigh().c_str(),
            props.fatalHigh().c_str());
+    if (showInventory)
+    {
+        const size_t item_pos = sample.inventory.rfind('/');
+        printf(" %s", sample.inventory.empty()
+                          ? "N/A"
+                          : sample.inventory.c_str() + item_pos + 1);
+    }
+    printf("\n");
 }
 
 /**
- * @brief compare sensors path with numbers
+ * @brief Show the sensors tables and the summary as requested
+ *
+ * @param samples - Sensors to show
  */
-struct CmpSensorsName
+static void printListing(const Samples& samples)
 {
-    bool operator()(const std::string& a, const std::string& b) const
+    if (showSummary != Summary::only)
     {
-        const char* strA = a.c_str();
-        const char* strB = b.c_str();
-        while (true)
+        bool cached = false;
+        for (const auto& sample : samples)
         {
-            const char& chrA = *strA;
-            const char& chrB = *strB;
-
-            // check for end of name
-            if (!chrA || !chrB)
-            {
-                return !!chrB;
-            }
-
-            const bool isNumA = (chrA >= '0' && chrA <= '9');
-            const bool isNumB = (chrB >= '0' && chrB <= '9');
-
-            if (isNumA && isNumB)
-            {
-                // both names have numbers at the same position
-                char* endA = nullptr;
-                char* endB = nullptr;
-                const unsigned long valA = strtoul(strA, &endA, 10);
-                const unsigned long valB = strtoul(strB, &endB, 10);
-
-                if (valA != valB)
-                {
-                    return valA < valB;
-                }
-
-                strA = endA;
-                strB = endB;
-            }
-            else if (isNumA || isNumB)
-            {
-                // only one of names has a number
-                return isNumA;
-            }
-            else
-            {
-                // no digits at position
-                if (chrA != chrB)
-                {
-                    return chrA < chrB;
-                }
-
-                ++strA;
-                ++strB;
-            }
+            printSensorData(sample);
+            cached = cached || sample.props.count(CACHED_PROPERTY);
+        }
+        if (cached)
+        {
+            printf("\n* Unavailable recently, not asked again yet\n");
         }
     }
-};
-
-using Path = std::string;
-using Service = std::string;
-using Interface = std::string;
-using Interfaces = std::vector<Interface>;
-using ObjectsMap = std::map<Service, Interfaces>;
-using Objects = std::map<Path, ObjectsMap, CmpSensorsName>;
+    if (showSummary != Summary::none)
+    {
+        if (showSummary == Summary::footer && !samples.empty())
+        {
+            printf("\n");
+        }
+        printSummary(summarize(samples));
+    }
+}
 
 /**
- * @brief Run infinite loop to print sensor values each \p watch_interval
- * seconds
+ * @brief Show a single line of the watch mode output
  *
- * @param watch_list - List of sensor names to print
- * @param watch_interval - Interval to wait
- * @param objects - List of all sensors in the system
- * @return EXIT_FAILURE
+ * @param timestamp - Time when the samples were taken
+ * @param samples   - Watched sensors in the user specified order
  */
-static int watch_senors(const std::vector<std::string>& watch_list,
-                        const int& watch_interval, const Objects& objects)
+static void printWatchLine(time_t timestamp, const Samples& samples)
 {
-    std::vector<std::pair<Service, Path>> sensors;
+    char date_str[20];
+    strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M:%S",
+             localtime(&timestamp));
+    printf("%s", date_str);
+    for (const auto& sample : samples)
+    {
+        printf("\t%s", formatValue(sample.props).c_str());
+    }
+    printf("\n");
+}
 
-    // we want to display sensors in order they were specified by user, so we
-    // cant just loop over objects and then use find on sensors_list
-    for (const auto& name : watch_list)
+/**
+ * @brief Score the watched values and report the anomalous ones
+ *
+ * @param detector  - Anomaly detector of the samples
+ * @param timestamp - Time when the samples were taken
+ * @param samples   - Sensors data, in the same order on every call
+ */
+static void printAnomalies(AnomalyDetector& detector, time_t timestamp,
+                           const Samples& samples)
+{
+    for (size_t i = 0; i < samples.size(); ++i)
     {
-        bool found = false;
-        for (const auto& obj : objects)
+        const auto value = samples[i].props.reading();
+        if (!value)
         {
-            size_t name_pos = obj.first.rfind('/');
-            if (name == obj.first.substr(name_pos + 1))
-            {
-                found = true;
-                for (const auto& service : obj.second)
-                {
-                    sensors.emplace_back(service.first, obj.first);
-                }
-            }
+            continue;
         }
-        if (!found)
+        const auto score = detector.update(i, *value);
+        if (score)
         {
-            fprintf(stderr, "Failed to find sensor %s!\n", name.c_str());
-            return EXIT_FAILURE;
+            const std::string& path = samples[i].path;
+            char date_str[20];
+            strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M:%S",
+                     localtime(&timestamp));
+            printf("%s\t# anomaly: %s %g z=%+.1f\n", date_str,
+                   path.c_str() + path.rfind('/') + 1, *value, *score);
         }
     }
+}
 
-    while (true)
+/**
+ * @brief Account the watched values and show the predicted threshold
+ * crossings, the most urgent first
+ *
+ * @param predictor - Trend predictor of the samples
+ * @param now       - Monotonic time of the samples, seconds
+ * @param timestamp - Time when the samples were taken
+ * @param samples   - Sensors data, in the same order on every call
+ */
+static void printPredictions(TrendPredictor& predictor, double now,
+                             time_t timestamp, const Samples& samples)
+{
+    std::vector<std::pair<TrendPredictor::Prediction, size_t>> urgent;
+    for (size_t i = 0; i < samples.size(); ++i)
     {
-        time_t t;
-        time(&t);
-        char date_str[20];
-        strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M:%S",
-                 localtime(&t));
-        printf("%s", date_str);
-        for (const auto& [service, path] : sensors)
+        const Properties& props = samples[i].props;
+        if (const auto value = props.reading())
         {
-            // Ask DBus for all sensors properties
-            auto m = systemBus.new_method_call(service.c_str(), path.c_str(),
-                                               SYSTEMD_PROPERTIES, "GetAll");
-            m.append("");
-            auto r = systemBus.call(m);
-
-            if (r.is_method_error())
+            predictor.update(i, now, *value);
+            const auto prediction = predictor.predict(i, now, props);
+            if (prediction && prediction->eta <= predictHorizon)
             {
-                fprintf(stderr, "Get properties for %s failed\n", path.c_str());
-                return EXIT_FAILURE;
+                urgent.emplace_back(*prediction, i);
             }
-
-            Properties props;
-            r.read(props);
-            printf("\t%s", props.value().c_str());
         }
-        printf("\n");
-        sleep(watch_interval);
     }
-    return EXIT_SUCCESS;
+    std::sort(urgent.begin(), urgent.end(), [](const auto& a, const auto& b) {
+        return a.first.eta < b.first.eta;
+    });
+
+    char date_str[20];
+    strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M:%S",
+             localtime(&timestamp));
+    for (const auto& [prediction, i] : urgent)
+    {
+        const std::string& path = samples[i].path;
+        printf("%s\t# predict: %s reaches %s %g in ~%.0f s\n", date_str,
+               path.c_str() + path.rfind('/') + 1, prediction.threshold,
+               prediction.limit, prediction.eta);
+    }
 }
 
 /**
- * @brief Prints the application usage help
+ * @brief Mark the watch mode output gap
  *
- * @return EXIT_FAILURE
+ * @param lost    - Time when the connection was lost
+ * @param resumed - Time when the connection was restored
  */
-static int usage(char *progname, bool cli_mode)
+static void printWatchGap(time_t lost, time_t resumed)
 {
-    if (cli_mode)
-    {
-        fprintf(stderr, "Sensor readings\n"
-                        "  [TYPE] - An optional type of sensors to list\n"
-                        "           Available types are:\n"
-                        "             voltage\n"
-                        "             current\n"
-                        "             power\n"
-                        "             temperature\n"
-                        "             fan_pwm\n"
-                        "             fan_tach\n"
-                        "  Options:\n"
-                        "      -C, --color              Enable colors\n"
-                        "      -w, --watch <sensors>    Print sensors values "
-                        "each n seconds (comma-separated list)\n"
-                        "      -n, --interval <secs>    Seconds to wait "
-                        "between updates in watch mode\n");
-    }
-    else
-    {
-        fprintf(stderr,
-                "Usage: %s [options] [sensors-type]\n"
-                "  Shows all sensors of the specified type.\n"
-                "  If the type is not specified shows all found sensors.\n"
-                "Options:\n"
-#ifdef WITH_REMOTE_HOST
-                "  -H, --host=[USER@]HOST   Operate on remote host (over ssh)\n"
-#endif
-                "  -c, --cli                CLI mode for obmc-yadro-cli\n"
-                "  -C, --color              Enable colors\n"
-                "  -w, --watch <sensors>    Print sensors values each n "
-                "seconds (comma-separated list)\n"
-                "  -n, --interval <secs>    Seconds to wait between updates in "
-                "watch mode\n"
-                "  -h, --help               Show this help\n",
-                progname);
-    }
-    return EXIT_FAILURE;
+    char lost_str[20];
+    char resumed_str[20];
+    strftime(lost_str, sizeof(lost_str), "%Y-%m-%d %H:%M:%S",
+             localtime(&lost));
+    strftime(resumed_str, sizeof(resumed_str), "%Y-%m-%d %H:%M:%S",
+             localtime(&resumed));
+    printf("%s\t# gap: connection lost, resumed at %s\n", lost_str,
+           resumed_str);
 }
 
 /**
- * @brief Application entry point
+ * @brief Compact binary representation of the sensors data.
  *
- * @return
+ * Used to stream sensors data from the agent running on the BMC to the
+ * rendering side. The stream starts with the 4 bytes magic and the format
+ * version, followed by a sequence of frames. Each frame starts with its type
+ * byte. All integers are little-endian, strings are prefixed with their
+ * 16-bit length.
+ *
+ * Snapshot frame ('S'):
+ *   u64 timestamp, u32 samples count, then for each sample:
+ *   string path, string service, string inventory item (since version 2),
+ *   u16 properties count, then for each property:
+ *   string name, u8 type ('x', 's', 'b' or 'd'), value.
+ *
+ * Gap frame ('G'), no data were collected in the period:
+ *   u64 timestamp of the connection lost, u64 timestamp of its restoring.
  */
-int main(int argc, char* argv[])
+static constexpr char BINARY_MAGIC[] = {'L', 'S', 'S', 'B'};
+static constexpr uint8_t BINARY_VERSION = 2;
+static constexpr uint8_t FRAME_SNAPSHOT = 'S';
+static constexpr uint8_t FRAME_GAP = 'G';
+
+/**
+ * @brief Binary stream encoder
+ */
+class BinaryWriter
 {
-#ifdef WITH_REMOTE_HOST
-    const char* host = nullptr;
-#endif
-    bool showhelp = false;
-    bool cli_mode = false;
-    bool watch_mode = false;
-    std::vector<std::string> watch_list;
-    int watch_interval = 1;
-    const struct option opts[] = {
-#ifdef WITH_REMOTE_HOST
-        {"host", required_argument, nullptr, 'H'},
-#endif
-        {"cli", no_argument, nullptr, 'c'},
+  public:
+    explicit BinaryWriter(FILE* out) : out(out)
+    {
+    }
+
+    /**
+     * @brief Write the stream header
+     */
+    void header()
+    {
+        fwrite(BINARY_MAGIC, sizeof(BINARY_MAGIC), 1, out);
+        putU8(BINARY_VERSION);
+    }
+
+    /**
+     * @brief Write the snapshot frame
+     *
+     * @param timestamp - Time when the samples were taken
+     * @param samples   - Sensors data
+     */
+    void snapshot(time_t timestamp, const Samples& samples)
+    {
+        putU8(FRAME_SNAPSHOT);
+        putU64(static_cast<uint64_t>(timestamp));
+        putU32(static_cast<uint32_t>(samples.size()));
+        for (const auto& sample : samples)
+        {
+            putString(sample.path);
+            putString(sample.service);
+            putString(sample.inventory);
+            putU16(static_cast<uint16_t>(sample.props.size()));
+            for (const auto& [name, value] : sample.props)
+            {
+                putString(name);
+                if (std::holds_alternative<int64_t>(value))
+                {
+                    putU8('x');
+                    putU64(static_cast<uint64_t>(std::get<int64_t>(value)));
+                }
+                else if (std::holds_alternative<std::string_view>(value))
+                {
+                    putU8('s');
+                    putString(std::get<std::string_view>(value));
+                }
+                else if (std::holds_alternative<bool>(value))
+                {
+                    putU8('b');
+                    putU8(std::get<bool>(value) ? 1 : 0);
+                }
+                else
+                {
+                    uint64_t bits;
+                    const double dbl = std::get<double>(value);
+                    static_assert(sizeof(bits) == sizeof(dbl));
+                    memcpy(&bits, &dbl, sizeof(bits));
+                    putU8('d');
+                    putU64(bits);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Write the gap frame
+     *
+     * @param lost    - Time when the connection was lost
+     * @param resumed - Time when the connection was restored
+     */
+    void gap(time_t lost, time_t resumed)
+    {
+        putU8(FRAME_GAP);
+        putU64(static_cast<uint64_t>(lost));
+        putU64(static_cast<uint64_t>(resumed));
+    }
+
+  private:
+    void putU8(uint8_t value)
+    {
+        fputc(value, out);
+    }
+    void putU16(uint16_t value)
+    {
+        putU8(value & 0xff);
+        putU8(value >> 8);
+    }
+    void putU32(uint32_t value)
+    {
+        putU16(value & 0xffff);
+        putU16(value >> 16);
+    }
+    void putU64(uint64_t value)
+    {
+        putU32(value & 0xffffffff);
+        putU32(value >> 32);
+    }
+    void putString(std::string_view value)
+    {
+        const size_t len = std::min<size_t>(value.size(), UINT16_MAX);
+        putU16(static_cast<uint16_t>(len));
+        fwrite(value.data(), len, 1, out);
+    }
+
+    FILE* out;
+};
+
+/**
+ * @brief Binary stream decoder
+ */
+class BinaryReader
+{
+  public:
+    explicit BinaryReader(FILE* in) : in(in)
+    {
+    }
+
+    /**
+     * @brief Read and validate the stream header
+     *
+     * @return false if the stream is not in the expected format
+     */
+    bool header()
+    {
+        char magic[sizeof(BINARY_MAGIC)];
+        return fread(magic, sizeof(magic), 1, in) == 1 &&
+               !memcmp(magic, BINARY_MAGIC, sizeof(magic)) &&
+               getU8(version) && version >= 1 && version <= BINARY_VERSION;
+    }
+
+    /**
+     * @brief Read the type of the next frame
+     *
+     * @param type - Frame type storage
+     *
+     * @return false on the end of stream
+     */
+    bool frame(uint8_t& type)
+    {
+        return getU8(type);
+    }
+
+    /**
+     * @brief Read the snapshot frame body
+     *
+     * @param timestamp - Time when the samples were taken
+     * @param samples   - Sensors data storage
+     *
+     * @return false on malformed data
+     */
+    bool snapshot(time_t& timestamp, Samples& samples)
+    {
+        uint64_t time;
+        uint32_t count;
+        if (!getU64(time) || !getU32(count))
+        {
+            return false;
+        }
+
+        timestamp = static_cast<time_t>(time);
+        samples.clear();
+        // The count is not trusted, the file size bounds the space to
+        // reserve: every sample takes at least its three string lengths and
+        // the properties count
+        struct stat st;
+        const long pos = ftell(in);
+        if (pos >= 0 && fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > pos)
+        {
+            samples.reserve(std::min<uint64_t>(
+                count, static_cast<uint64_t>(st.st_size - pos) / 8));
+        }
+        while (count--)
+        {
+            Sample sample;
+            uint16_t props;
+            if (!getString(sample.path) || !getString(sample.service) ||
+                (version >= 2 && !getString(sample.inventory)) ||
+                !getU16(props))
+            {
+                return false;
+            }
+            while (props--)
+            {
+                std::string name;
+                uint8_t kind;
+                if (!getString(name) || !getU8(kind))
+                {
+                    return false;
+                }
+
+                PropertyValue value;
+                uint8_t flag;
+                uint64_t bits;
+                std::string str;
+                switch (kind)
+                {
+                    case 'x':
+                        if (!getU64(bits))
+                        {
+                            return false;
+                        }
+                        value = static_cast<int64_t>(bits);
+                        break;
+                    case 's':
+                        if (!getString(str))
+                        {
+                            return false;
+                        }
+                        value = sample.props.keep(std::move(str));
+                        break;
+                    case 'b':
+                        if (!getU8(flag))
+                        {
+                            return false;
+                        }
+                        value = flag != 0;
+                        break;
+                    case 'd': {
+                        double dbl;
+                        if (!getU64(bits))
+                        {
+                            return false;
+                        }
+                        memcpy(&dbl, &bits, sizeof(dbl));
+                        value = dbl;
+                        break;
+                    }
+                    default:
+                        return false;
+                }
+                sample.props.emplace(sample.props.keep(std::move(name)),
+                                     value);
+            }
+            samples.emplace_back(std::move(sample));
+        }
+        return true;
+    }
+
+    /**
+     * @brief Read the gap frame body
+     *
+     * @param lost    - Time when the connection was lost
+     * @param resumed - Time when the connection was restored
+     *
+     * @return false on malformed data
+     */
+    bool gap(time_t& lost, time_t& resumed)
+    {
+        uint64_t lostTime;
+        uint64_t resumedTime;
+        if (!getU64(lostTime) || !getU64(resumedTime))
+        {
+            return false;
+        }
+        lost = static_cast<time_t>(lostTime);
+        resumed = static_cast<time_t>(resumedTime);
+        return true;
+    }
+
+  private:
+    bool getU8(uint8_t& value)
+    {
+        const int chr = fgetc(in);
+        value = static_cast<uint8_t>(chr);
+        return chr != EOF;
+    }
+    bool getU16(uint16_t& value)
+    {
+        uint8_t lo, hi;
+        if (!getU8(lo) || !getU8(hi))
+        {
+            return false;
+        }
+        value = static_cast<uint16_t>(lo | (hi << 8));
+        return true;
+    }
+    bool getU32(uint32_t& value)
+    {
+        uint16_t lo, hi;
+        if (!getU16(lo) || !getU16(hi))
+        {
+            return false;
+        }
+        value = lo | (static_cast<uint32_t>(hi) << 16);
+        return true;
+    }
+    bool getU64(uint64_t& value)
+    {
+        uint32_t lo, hi;
+        if (!getU32(lo) || !getU32(hi))
+        {
+            return false;
+        }
+        value = lo | (static_cast<uint64_t>(hi) << 32);
+        return true;
+    }
+    bool getString(std::string& value)
+    {
+        uint16_t len;
+        if (!getU16(len))
+        {
+            return false;
+        }
+        value.resize(len);
+        return !len || fread(value.data(), len, 1, in) == 1;
+    }
+
+    FILE* in;
+    uint8_t version = BINARY_VERSION;
+};
+
+/**
+ * @brief Watch mode settings
+ */
+struct WatchOptions
+{
+    // Interval between samples, seconds
+    double interval = 1;
+    // Reduce the wakeups and the CPU usage of the sampling loop
+    bool lowOverhead = false;
+    // CPU usage limit, percents (0 - unlimited)
+    double cpuBudget = 0;
+    // Period of the own overhead report, seconds (0 - disabled)
+    unsigned reportInterval = 0;
+    // CPU to pin the sampler to (-1 - any)
+    int cpu = -1;
+    // SCHED_FIFO priority (0 - keep the default scheduler)
+    unsigned rtPriority = 0;
+    // Nice value to set, if specified
+    std::optional<int> nice;
+    // Lock the process memory
+    bool mlock = false;
+    // Collect the wakeup jitter histogram
+    bool jitter = false;
+    // Collect the values histograms
+    bool histogram = false;
+    // Print the values histograms in JSON format
+    bool histogramJson = false;
+    // Read the values of the local sensors from hwmon
+    bool hwmon = false;
+    // Sensors to hwmon attributes map file, nullptr to match by labels
+    const char* hwmonMap = nullptr;
+    // Hwmon class directory
+    const char* hwmonRoot = HWMON_ROOT;
+};
+
+/**
+ * @brief Histogram of the tick wakeup delays.
+ *
+ * Fixed set of buckets with 1-2-5 bounds, so adding a value is cheap and
+ * never allocates.
+ */
+class JitterHistogram
+{
+  public:
+    /**
+     * @brief Account the wakeup delay
+     *
+     * @param delay - Actual wakeup time minus the intended one, us
+     */
+    void add(uint64_t delay)
+    {
+        size_t i = 0;
+        while (i < std::size(bounds) && delay >= bounds[i])
+        {
+            ++i;
+        }
+        ++counts[i];
+        ++total;
+        sum += delay;
+        max = std::max(max, delay);
+    }
+
+    /**
+     * @brief Print the histogram
+     */
+    void print(FILE* out) const
+    {
+        if (!total)
+        {
+            return;
+        }
+        fprintf(out, "Jitter: %zu ticks, mean %.1f us, max %" PRIu64 " us\n",
+                total, static_cast<double>(sum) / total, max);
+        uint64_t lower = 0;
+        for (size_t i = 0; i < std::size(counts); ++i)
+        {
+            if (counts[i])
+            {
+                char range[32];
+                if (i < std::size(bounds))
+                {
+                    snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64,
+                             lower, bounds[i]);
+                }
+                else
+                {
+                    snprintf(range, sizeof(range), ">=%" PRIu64, lower);
+                }
+                fprintf(out, "  %14s us: %8zu %6.2f%%\n", range, counts[i],
+                        counts[i] * 100.0 / total);
+            }
+            if (i < std::size(bounds))
+            {
+                lower = bounds[i];
+            }
+        }
+    }
+
+  private:
+    // Upper bounds of the buckets, us
+    static constexpr uint64_t bounds[] = {
+        10,    20,    50,     100,    200,    500,    1000,
+        2000,  5000,  10000,  20000,  50000,  100000,
+    };
+
+    size_t counts[std::size(bounds) + 1] = {};
+    size_t total = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+};
+
+/**
+ * @brief Escape the string for JSON output
+ */
+static std::string jsonString(const std::string& str)
+{
+    std::string ret = "\"";
+    for (const char chr : str)
+    {
+        if (chr == '"' || chr == '\\')
+        {
+            ret += '\\';
+            ret += chr;
+        }
+        else if (static_cast<unsigned char>(chr) < 0x20)
+        {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", chr);
+            ret += esc;
+        }
+        else
+        {
+            ret += chr;
+        }
+    }
+    ret += "\"";
+    return ret;
+}
+
+/**
+ * @brief Print the values distribution of the watched sensors
+ *
+ * @param out        - Output stream
+ * @param samples    - Watched sensors
+ * @param histograms - Histograms of the sensors values
+ * @param json       - Print in JSON format instead of the table
+ */
+static void printHistograms(FILE* out, const Samples& samples,
+                            const std::vector<ValueHistogram>& histograms,
+                            bool json)
+{
+    static constexpr double percentiles[] = {50, 90, 99, 99.9};
+
+    if (json)
+    {
+        fprintf(out, "{");
+    }
+    else
+    {
+        fprintf(out, "%-19s %10s %8s %8s %8s %8s %8s %8s %8s %s\n", "Name",
+                "Samples", "Min", "P50", "P90", "P99", "P99.9", "Max", "Mean",
+                "Unit");
+    }
+
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        const std::string& path = samples[i].path;
+        const std::string name = path.substr(path.rfind('/') + 1);
+        std::string unit = samples[i].props.unit();
+        unit.erase(unit.find_last_not_of(' ') + 1);
+        const ValueHistogram& hist = histograms[i];
+
+        if (json)
+        {
+            fprintf(out,
+                    "%s\n  %s: {\"unit\": %s, \"samples\": %" PRIu64,
+                    i ? "," : "", jsonString(name).c_str(),
+                    jsonString(unit).c_str(), hist.count());
+            if (hist.count())
+            {
+                fprintf(out,
+                        ", \"min\": %g, \"max\": %g, \"mean\": %g, "
+                        "\"percentiles\": {",
+                        hist.minimum(), hist.maximum(), hist.mean());
+                for (size_t p = 0; p < std::size(percentiles); ++p)
+                {
+                    fprintf(out, "%s\"%g\": %g", p ? ", " : "",
+                            percentiles[p], hist.percentile(percentiles[p]));
+                }
+                fprintf(out, "}, \"buckets\": [");
+                bool first = true;
+                hist.forEachBucket([&](double value, uint64_t count) {
+                    fprintf(out, "%s[%g, %" PRIu64 "]", first ? "" : ", ",
+                            value, count);
+                    first = false;
+                });
+                fprintf(out, "]");
+            }
+            fprintf(out, "}");
+        }
+        else if (hist.count())
+        {
+            fprintf(out,
+                    "%-19.19s %10" PRIu64
+                    " %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %s\n",
+                    name.c_str(), hist.count(), hist.minimum(),
+                    hist.percentile(50), hist.percentile(90),
+                    hist.percentile(99), hist.percentile(99.9), hist.maximum(),
+                    hist.mean(), unit.c_str());
+        }
+        else
+        {
+            fprintf(out, "%-19.19s %10d\n", name.c_str(), 0);
+        }
+    }
+
+    if (json)
+    {
+        fprintf(out, "\n}\n");
+    }
+    fflush(out);
+}
+
+// Signal received by the long running mode
+static volatile sig_atomic_t pendingSignal = 0;
+
+/**
+ * @brief Remember the signal to handle it in the main loop
+ */
+static void onSignal(int signo)
+{
+    pendingSignal = signo;
+}
+
+/**
+ * @brief Apply the real-time settings of the sampler
+ *
+ * @param watch - Watch mode settings
+ *
+ * @return false if any of the settings can't be applied
+ */
+static bool applyRealtime(const WatchOptions& watch)
+{
+    if (watch.cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(watch.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        {
+            fprintf(stderr, "Failed to pin to CPU %d: %s\n", watch.cpu,
+                    strerror(errno));
+            return false;
+        }
+    }
+    if (watch.nice && setpriority(PRIO_PROCESS, 0, *watch.nice) != 0)
+    {
+        fprintf(stderr, "Failed to set nice %d: %s\n", *watch.nice,
+                strerror(errno));
+        return false;
+    }
+    if (watch.rtPriority)
+    {
+        struct sched_param param = {};
+        param.sched_priority = static_cast<int>(watch.rtPriority);
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0)
+        {
+            fprintf(stderr, "Failed to set SCHED_FIFO priority %u: %s\n",
+                    watch.rtPriority, strerror(errno));
+            return false;
+        }
+    }
+    if (watch.mlock)
+    {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        {
+            fprintf(stderr, "Failed to lock memory: %s\n", strerror(errno));
+            return false;
+        }
+        // Prefault the stack, so the sampling loop doesn't hit page faults
+        volatile char stack[64 * 1024];
+        for (size_t i = 0; i < sizeof(stack); i += 4096)
+        {
+            stack[i] = 0;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Get CPU time consumed by the process, us
+ */
+static uint64_t cpuTimeUsec()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ull +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/**
+ * @brief Sleep until the specified monotonic time or a signal
+ *
+ * @param time - Monotonic time to wake up at, us
+ */
+static void sleepUntil(uint64_t time)
+{
+    struct timespec ts;
+    ts.tv_sec = time / 1000000;
+    ts.tv_nsec = (time % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+               EINTR &&
+           !pendingSignal)
+    {
+    }
+}
+
+/**
+ * @brief Trim the alignment spaces of the formatted value
+ */
+static std::string trimmed(std::string str)
+{
+    str.erase(0, str.find_first_not_of(' '));
+    str.erase(str.find_last_not_of(' ') + 1);
+    return str;
+}
+
+/**
+ * @brief Revalidate the sample failed to fetch, reporting the failure
+ *
+ * @return false on unrecoverable error
+ */
+static bool revalidate(Sample& sample)
+{
+    const int rc = revalidateSample(sample);
+    if (rc < 0)
+    {
+        fprintf(stderr, "Get properties for %s failed: %s\n",
+                sample.path.c_str(), strerror(-rc));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Restore the lost bus connection, reporting the progress
+ *
+ * @param cancelled - See lssensors::reconnect()
+ *
+ * @return false if cancelled
+ */
+static bool restoreBus(const std::function<bool()>& cancelled = nullptr)
+{
+    fprintf(stderr, "Bus connection lost, reconnecting...\n");
+    if (!reconnect(cancelled))
+    {
+        return false;
+    }
+    fprintf(stderr, "Bus connection restored\n");
+    return true;
+}
+
+/**
+ * @brief Watch mode engine.
+ *
+ * Runs on a single sd-event loop with the bus attached: the ticks come from
+ * the timer, SIGINT, SIGTERM and SIGUSR1 through signalfd, and the commands
+ * from stdin as I/O events, so there are no extra threads. The watched
+ * sensors can be changed at run time without the new discovery.
+ *
+ * In the low overhead mode the timer is allowed to fire late to let the
+ * kernel coalesce the wakeups, and with the CPU budget the interval is
+ * stretched when sampling takes more CPU time than allowed.
+ */
+class WatchLoop
+{
+  public:
+    /**
+     * @brief Constructor
+     *
+     * @param watch    - Watch mode settings
+     * @param topology - All sensors in the system and their relations
+     * @param fetcher  - Sensors properties fetcher
+     */
+    WatchLoop(const WatchOptions& watch, const Topology& topology,
+              Fetcher& fetcher) :
+        watch(watch), topology(topology), fetcher(fetcher),
+        interval(static_cast<uint64_t>(watch.interval * 1e6)), wait(interval),
+        sweepTimeout(fetcher.timeout()),
+        histogramOut(binaryOutput ? stderr : stdout), writer(stdout)
+    {}
+
+    ~WatchLoop()
+    {
+        fetcher.setTimeout(sweepTimeout);
+        sd_event_source_unref(timer);
+        sd_event_source_unref(input);
+        for (auto source : signals)
+        {
+            sd_event_source_unref(source);
+        }
+        sd_event_unref(event);
+    }
+
+    WatchLoop(const WatchLoop&) = delete;
+    WatchLoop& operator=(const WatchLoop&) = delete;
+
+    /**
+     * @brief Add the sensors with the name to the watched ones
+     *
+     * @return false if there is no such sensor
+     */
+    bool add(const std::string& name)
+    {
+        bool found = false;
+        for (const auto& obj : topology.objects)
+        {
+            if (!isNamed(obj.first, name))
+            {
+                continue;
+            }
+            found = true;
+            auto item = topology.inventory.find(obj.first);
+            for (const auto& service : obj.second)
+            {
+                samples.push_back({obj.first, service.first, {},
+                                   item != topology.inventory.end()
+                                       ? item->second
+                                       : Path()});
+            }
+        }
+        if (found)
+        {
+            if (watch.histogram)
+            {
+                histograms.resize(samples.size());
+            }
+            changed();
+        }
+        return found;
+    }
+
+    /**
+     * @brief Stop watching the sensors with the name
+     *
+     * @return false if there is no such sensor watched
+     */
+    bool remove(const std::string& name)
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            if (!isNamed(samples[i].path, name))
+            {
+                if (kept != i)
+                {
+                    samples[kept] = std::move(samples[i]);
+                    if (watch.histogram)
+                    {
+                        histograms[kept] = std::move(histograms[i]);
+                    }
+                }
+                ++kept;
+            }
+        }
+        if (kept == samples.size())
+        {
+            return false;
+        }
+        samples.resize(kept);
+        if (watch.histogram)
+        {
+            histograms.resize(kept);
+        }
+        changed();
+        return true;
+    }
+
+    /**
+     * @brief Run the loop until a termination signal or a failure
+     *
+     * @return exit status
+     */
+    int run()
+    {
+        if (!applyRealtime(watch))
+        {
+            return EXIT_FAILURE;
+        }
+        if (watch.lowOverhead)
+        {
+            // Let the bus waits be coalesced as well
+            prctl(PR_SET_TIMERSLACK, accuracy() * 1000, 0, 0, 0);
+        }
+        if (useCache)
+        {
+            // The sensors unavailable at the moment are asked with a backoff
+            negative.emplace(NEGATIVE_MIN_DELAY, NEGATIVE_MAX_DELAY);
+            negative->subscribe(sensorsPath());
+        }
+        if (watch.hwmon)
+        {
+            hwmon.emplace(watch.hwmonRoot);
+        }
+
+        int rc = sd_event_default(&event);
+        if (rc < 0)
+        {
+            fprintf(stderr, "Failed to create the event loop: %s\n",
+                    strerror(-rc));
+            return EXIT_FAILURE;
+        }
+        bus().attach_event(event, SD_EVENT_PRIORITY_NORMAL);
+
+        // The signals are received through signalfd, so they are blocked
+        sigset_t mask;
+        sigemptyset(&mask);
+        for (int signo : {SIGINT, SIGTERM, SIGUSR1})
+        {
+            sigaddset(&mask, signo);
+        }
+        sigprocmask(SIG_BLOCK, &mask, nullptr);
+        for (int signo : {SIGINT, SIGTERM, SIGUSR1})
+        {
+            sd_event_source* source = nullptr;
+            rc = sd_event_add_signal(event, &source, signo, onSignalEvent,
+                                     this);
+            if (rc < 0)
+            {
+                fprintf(stderr, "Failed to handle signal %d: %s\n", signo,
+                        strerror(-rc));
+                return EXIT_FAILURE;
+            }
+            signals.push_back(source);
+        }
+        if (!agentMode && isatty(STDIN_FILENO))
+        {
+            rc = sd_event_add_io(event, &input, STDIN_FILENO, EPOLLIN,
+                                 onInput, this);
+            if (rc < 0)
+            {
+                fprintf(stderr, "Failed to read the commands: %s\n",
+                        strerror(-rc));
+                return EXIT_FAILURE;
+            }
+            fprintf(stderr, "Commands: + and - to change the interval, p to "
+                            "pause, a/r <sensor> to add/remove, q to quit\n");
+        }
+
+        boundSweep();
+        next = monotonicUsec();
+        lastCpu = cpuTimeUsec();
+        reportTime = next;
+        reportCpu = lastCpu;
+        reportWakeups = fetcher.wakeups();
+        rc = sd_event_add_time(event, &timer, CLOCK_MONOTONIC, next,
+                               accuracy(), onTick, this);
+        if (rc < 0)
+        {
+            fprintf(stderr, "Failed to create the timer: %s\n",
+                    strerror(-rc));
+            return EXIT_FAILURE;
+        }
+
+        rc = sd_event_loop(event);
+        fflush(stdout);
+        return rc < 0 ? EXIT_FAILURE : rc;
+    }
+
+  private:
+    /**
+     * @brief Check if the sensor path has the name
+     */
+    static bool isNamed(const Path& path, const std::string& name)
+    {
+        return !path.compare(path.rfind('/') + 1, std::string::npos, name);
+    }
+
+    /**
+     * @brief Allowed timer delay, us
+     */
+    uint64_t accuracy() const
+    {
+        // Let the timer fire anywhere within 5% of the interval
+        return watch.lowOverhead ? std::min<uint64_t>(interval / 20, 500000)
+                                 : 1;
+    }
+
+    /**
+     * @brief Limit the sweep time by the interval
+     *
+     * The sweep blocks the loop, so the signals and commands wait for its
+     * end; a slow service must not hold them for the whole bus timeout.
+     */
+    void boundSweep()
+    {
+        const unsigned limit =
+            static_cast<unsigned>(std::max<uint64_t>(interval / 1000, 1));
+        fetcher.setTimeout(sweepTimeout ? std::min(sweepTimeout, limit)
+                                        : limit);
+    }
+
+    /**
+     * @brief Print the values histograms collected so far
+     */
+    void printSummary()
+    {
+        if (watch.histogram)
+        {
+            printHistograms(histogramOut, samples, histograms,
+                            watch.histogramJson);
+        }
+    }
+
+    /**
+     * @brief Stop the loop on the user's request
+     */
+    void quit()
+    {
+        printSummary();
+        sd_event_exit(event, EXIT_SUCCESS);
+    }
+
+    /**
+     * @brief Restart the per-sensor state after the sensors set change
+     */
+    void changed()
+    {
+        detector.reset();
+        if (anomalyThreshold > 0 && !binaryOutput)
+        {
+            detector.emplace(samples.size(), anomalyThreshold, anomalyWindow);
+        }
+        predictor.reset();
+        if (predictWindow && !binaryOutput)
+        {
+            predictor.emplace(samples.size(), predictWindow);
+        }
+        // Fetch all properties and map the hwmon attributes again
+        tick = 0;
+        if (event && !binaryOutput)
+        {
+            std::string names;
+            for (const auto& sample : samples)
+            {
+                names += (names.empty() ? "" : ", ") +
+                         sample.path.substr(sample.path.rfind('/') + 1);
+            }
+            printf("# watching: %s\n", names.c_str());
+        }
+    }
+
+    /**
+     * @brief Schedule the next tick
+     *
+     * @param time - Monotonic time of the tick, us
+     */
+    void schedule(uint64_t time)
+    {
+        next = time;
+        sd_event_source_set_time(timer, next);
+        sd_event_source_set_time_accuracy(timer, accuracy());
+        sd_event_source_set_enabled(timer,
+                                    paused ? SD_EVENT_OFF : SD_EVENT_ONESHOT);
+    }
+
+    /**
+     * @brief Take and show the samples
+     *
+     * @return false if the loop is stopped
+     */
+    bool sample()
+    {
+        time_t t;
+        time(&t);
+        try
+        {
+            const uint64_t refreshTicks =
+                std::max<uint64_t>(1, 10000000 / interval);
+            if (hwmon && tick % refreshTicks)
+            {
+                skip = hwmon->mapped();
+            }
+            else
+            {
+                skip.assign(samples.size(), false);
+            }
+            if (negative)
+            {
+                negativeMask.assign(samples.size(), false);
+                negative->skip(samples, monotonicUsec(), negativeMask);
+                for (size_t i = 0; i < samples.size(); ++i)
+                {
+                    skip[i] = skip[i] || negativeMask[i];
+                }
+            }
+            fetcher.fetch(samples, skip);
+            for (size_t i = 0; i < samples.size(); ++i)
+            {
+                if (fetcher.failed(i) && !fetcher.timedOut(i) &&
+                    !revalidate(samples[i]))
+                {
+                    sd_event_exit(event, EXIT_FAILURE);
+                    return false;
+                }
+            }
+            if (negative)
+            {
+                negative->update(samples, fetcher, negativeMask,
+                                 monotonicUsec());
+            }
+            if (hwmon && !tick)
+            {
+                // The Value type and scale are known after the first fetch
+                const size_t mapped = hwmon->map(samples, watch.hwmonMap);
+                fprintf(stderr, "%zu of %zu sensors are read from hwmon\n",
+                        mapped, samples.size());
+            }
+            if (hwmon)
+            {
+                hwmon->read(samples);
+            }
+            ++tick;
+        }
+        catch (const sdbusplus::exception::SdBusError& ex)
+        {
+            if (!isConnectionLost(ex))
+            {
+                fprintf(stderr, "Error: %s\n", ex.what());
+                sd_event_exit(event, EXIT_FAILURE);
+                return false;
+            }
+            fprintf(stderr, "Bus connection lost, reconnecting...\n");
+            lost = t;
+            reconnectDelay = RECONNECT_MIN_DELAY;
+            restore();
+            return false;
+        }
+        catch (const std::runtime_error& ex)
+        {
+            fprintf(stderr, "Error: %s\n", ex.what());
+            sd_event_exit(event, EXIT_FAILURE);
+            return false;
+        }
+
+        for (size_t i = 0; i < histograms.size(); ++i)
+        {
+            if (const auto value = samples[i].props.reading())
+            {
+                histograms[i].add(*value);
+            }
+        }
+
+        if (binaryOutput)
+        {
+            writer.snapshot(t, samples);
+            if (fflush(stdout) != 0)
+            {
+                // The receiving side has gone away
+                sd_event_exit(event, agentMode ? EXIT_SUCCESS : EXIT_FAILURE);
+                return false;
+            }
+        }
+        else
+        {
+            printWatchLine(t, samples);
+            if (detector)
+            {
+                printAnomalies(*detector, t, samples);
+            }
+            if (predictor)
+            {
+                printPredictions(*predictor, monotonicUsec() / 1e6, t,
+                                 samples);
+            }
+        }
+        if (showStats)
+        {
+            fetcher.printStats(stderr);
+        }
+        alloc.report("tick");
+        return true;
+    }
+
+    /**
+     * @brief Try to restore the lost bus connection
+     *
+     * The attempts are made on the timer, so the signals and the commands
+     * are handled meanwhile.
+     */
+    void restore()
+    {
+        if (!tryReconnect())
+        {
+            schedule(monotonicUsec() + reconnectDelay);
+            reconnectDelay = std::min(reconnectDelay * 2, RECONNECT_MAX_DELAY);
+            return;
+        }
+        fprintf(stderr, "Bus connection restored\n");
+        // The new connection replaces the one attached to the loop
+        bus().attach_event(event, SD_EVENT_PRIORITY_NORMAL);
+        if (negative)
+        {
+            negative.emplace(NEGATIVE_MIN_DELAY, NEGATIVE_MAX_DELAY);
+            negative->subscribe(sensorsPath());
+        }
+        if (binaryOutput)
+        {
+            writer.gap(lost, time(nullptr));
+        }
+        else
+        {
+            printWatchGap(lost, time(nullptr));
+        }
+        lost = 0;
+        // Take the samples right after the connection is restored
+        schedule(monotonicUsec());
+    }
+
+    /**
+     * @brief Account the tick overhead and report it periodically
+     */
+    void account()
+    {
+        const uint64_t cpu = cpuTimeUsec();
+        if (watch.cpuBudget > 0)
+        {
+            tickCpu = (tickCpu * 7 + (cpu - lastCpu)) / 8;
+            wait = std::max(interval, static_cast<uint64_t>(
+                                          tickCpu * 100 / watch.cpuBudget));
+        }
+        else
+        {
+            wait = interval;
+        }
+        lastCpu = cpu;
+        ++reportTicks;
+
+        const uint64_t now = monotonicUsec();
+        if (watch.reportInterval &&
+            now - reportTime >= watch.reportInterval * 1000000ull)
+        {
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            // Each tick is a single timer wakeup plus the bus waits
+            const size_t wakeups =
+                reportTicks + fetcher.wakeups() - reportWakeups;
+            fprintf(stderr,
+                    "Overhead: CPU %.3f%%, %zu ticks, %zu wakeups in %.0f s, "
+                    "interval %.3f s, max RSS %ld KiB\n",
+                    (cpu - reportCpu) * 100.0 / (now - reportTime),
+                    reportTicks, wakeups, (now - reportTime) / 1000000.0,
+                    wait / 1000000.0, usage.ru_maxrss);
+            if (watch.jitter)
+            {
+                jitter.print(stderr);
+            }
+            reportTime = now;
+            reportCpu = cpu;
+            reportTicks = 0;
+            reportWakeups = fetcher.wakeups();
+        }
+    }
+
+    /**
+     * @brief Handle the stdin command
+     */
+    void command(const std::string& line)
+    {
+        const size_t arg_pos = line.find(' ');
+        const std::string cmd = line.substr(0, arg_pos);
+        const std::string arg =
+            arg_pos == std::string::npos ? "" : trimmed(line.substr(arg_pos));
+
+        if (cmd == "+" || cmd == "-")
+        {
+            // The interval given on the command line may be out of range,
+            // it is never changed in the opposite direction
+            interval = cmd == "+"
+                           ? std::max(interval,
+                                      std::min(interval * 2, MAX_INTERVAL))
+                           : std::min(interval,
+                                      std::max(interval / 2, MIN_INTERVAL));
+            wait = interval;
+            boundSweep();
+            fprintf(stderr, "Interval %.3f s\n", interval / 1000000.0);
+            schedule(std::max(lastTick + interval, monotonicUsec()));
+        }
+        else if (cmd == "p")
+        {
+            paused = !paused;
+            fprintf(stderr, paused ? "Paused\n" : "Resumed\n");
+            schedule(monotonicUsec());
+        }
+        else if ((cmd == "a" || cmd == "r") && !arg.empty())
+        {
+            if (cmd == "a" ? !add(arg) : !remove(arg))
+            {
+                fprintf(stderr, "Failed to find sensor %s!\n", arg.c_str());
+            }
+        }
+        else if (cmd == "q")
+        {
+            quit();
+        }
+        else if (!cmd.empty())
+        {
+            fprintf(stderr, "Unknown command '%s'\n", line.c_str());
+        }
+    }
+
+    static int onTick(sd_event_source*, uint64_t, void* data)
+    {
+        auto self = static_cast<WatchLoop*>(data);
+        if (self->lost)
+        {
+            self->restore();
+            return 0;
+        }
+        const uint64_t now = monotonicUsec();
+        if (self->watch.jitter)
+        {
+            self->jitter.add(now - self->next);
+        }
+        self->lastTick = now;
+        if (!self->samples.empty() && !self->sample())
+        {
+            return 0;
+        }
+        self->account();
+        // Keep the schedule, but never try to catch up the missed ticks
+        self->schedule(std::max(self->next + self->wait, monotonicUsec()));
+        return 0;
+    }
+
+    static int onSignalEvent(sd_event_source*,
+                             const struct signalfd_siginfo* info, void* data)
+    {
+        auto self = static_cast<WatchLoop*>(data);
+        if (info->ssi_signo == SIGUSR1)
+        {
+            self->printSummary();
+            self->fetcher.printStats(stderr);
+            if (self->watch.jitter)
+            {
+                self->jitter.print(stderr);
+            }
+        }
+        else
+        {
+            self->quit();
+        }
+        return 0;
+    }
+
+    static int onInput(sd_event_source* source, int fd, uint32_t, void* data)
+    {
+        auto self = static_cast<WatchLoop*>(data);
+        char buf[256];
+        const ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            if (len == 0 || errno != EINTR)
+            {
+                // No more commands, keep watching
+                sd_event_source_set_enabled(source, SD_EVENT_OFF);
+            }
+            return 0;
+        }
+        self->pending.append(buf, len);
+        size_t end;
+        while ((end = self->pending.find('\n')) != std::string::npos)
+        {
+            const std::string line = trimmed(self->pending.substr(0, end));
+            self->pending.erase(0, end + 1);
+            self->command(line);
+        }
+        return 0;
+    }
+
+    WatchOptions watch;
+    const Topology& topology;
+    Fetcher& fetcher;
+    Samples samples;
+
+    sd_event* event = nullptr;
+    sd_event_source* timer = nullptr;
+    sd_event_source* input = nullptr;
+    std::vector<sd_event_source*> signals;
+    // Incomplete command line
+    std::string pending;
+    bool paused = false;
+
+    // Interval between samples, us
+    uint64_t interval;
+    // Interval stretched by the CPU budget, us
+    uint64_t wait;
+    // Sweep timeout set by the user, ms (0 - unlimited)
+    unsigned sweepTimeout;
+    // Scheduled time of the next tick and the start of the last one, us
+    uint64_t next = 0;
+    uint64_t lastTick = 0;
+    // Ticks since the last sensors set change
+    size_t tick = 0;
+    // Time the bus connection was lost, 0 if connected
+    time_t lost = 0;
+    useconds_t reconnectDelay = RECONNECT_MIN_DELAY;
+
+    // CPU time spent per tick, smoothed
+    uint64_t tickCpu = 0;
+    uint64_t lastCpu = 0;
+    // Overhead report period start
+    uint64_t reportTime = 0;
+    uint64_t reportCpu = 0;
+    size_t reportTicks = 0;
+    size_t reportWakeups = 0;
+
+    JitterHistogram jitter;
+    std::vector<ValueHistogram> histograms;
+    FILE* histogramOut;
+    // In the binary output the anomalies and predictions are left to the
+    // rendering side
+    std::optional<AnomalyDetector> detector;
+    std::optional<TrendPredictor> predictor;
+    std::optional<NegativeCache> negative;
+    std::vector<bool> negativeMask;
+    std::vector<bool> skip;
+    // With hwmon the other properties are refreshed from the bus about each
+    // 10 seconds
+    std::optional<HwmonReader> hwmon;
+    BinaryWriter writer;
+    AllocPhase alloc;
+};
+
+/**
+ * @brief Print the sensor values each \p watch.interval seconds until
+ * interrupted
+ *
+ * @param watch_list - List of sensor names to print
+ * @param watch - Watch mode settings
+ * @param topology - All sensors in the system and their relations
+ * @param fetcher - Sensors properties fetcher
+ * @return exit status
+ */
+static int watch_senors(const std::vector<std::string>& watch_list,
+                        const WatchOptions& watch, const Topology& topology,
+                        Fetcher& fetcher)
+{
+    WatchLoop loop(watch, topology, fetcher);
+
+    // we want to display sensors in order they were specified by user
+    for (const auto& name : watch_list)
+    {
+        if (!loop.add(name))
+        {
+            fprintf(stderr, "Failed to find sensor %s!\n", name.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    return loop.run();
+}
+
+/**
+ * @brief Show the sensor state transition
+ *
+ * @param timestamp - Time of the sample that completed the transition
+ * @param sample    - Sensor's properties snapshot
+ * @param from      - Previous state, none for the initial state
+ * @param to        - New state
+ */
+static void printEvent(time_t timestamp, const Sample& sample,
+                       std::optional<Status> from, Status to)
+{
+    const std::string& path = sample.path;
+    const size_t name_pos = path.rfind('/');
+    const size_t folder_pos = path.rfind('/', name_pos - 1);
+
+    char date_str[20];
+    strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M:%S",
+             localtime(&timestamp));
+    printf("%s\t%s\t%s -> %s\t%s\n", date_str, path.c_str() + folder_pos + 1,
+           from ? statusName(*from) : "start", statusName(to),
+           std::string(sample.props.value()).c_str());
+}
+
+/**
+ * @brief Run infinite loop to print the sensors state transitions.
+ *
+ * Only the changes are printed, so the output volume depends on the
+ * events rate, not on the interval. The sensors in a non-OK state are
+ * reported once at start.
+ *
+ * @param watch_list - List of sensor names to track, all sensors if empty
+ * @param watch      - Watch mode settings
+ * @param debounce   - Conditions to accept the new state
+ * @param topology   - All sensors in the system and their relations
+ * @param fetcher    - Sensors properties fetcher
+ * @return exit status
+ */
+static int watchEvents(const std::vector<std::string>& watch_list,
+                       const WatchOptions& watch,
+                       const StatusTracker::Debounce& debounce,
+                       const Topology& topology, Fetcher& fetcher)
+{
+    Samples samples = makeSamples(topology);
+    if (!watch_list.empty())
+    {
+        auto end = std::remove_if(
+            samples.begin(), samples.end(), [&](const Sample& sample) {
+                const char* name =
+                    sample.path.c_str() + sample.path.rfind('/') + 1;
+                return std::find(watch_list.begin(), watch_list.end(),
+                                 name) == watch_list.end();
+            });
+        samples.erase(end, samples.end());
+    }
+    if (samples.empty())
+    {
+        fprintf(stderr, "No sensors to track!\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!applyRealtime(watch))
+    {
+        return EXIT_FAILURE;
+    }
+
+    const uint64_t interval = static_cast<uint64_t>(watch.interval * 1e6);
+    if (watch.lowOverhead)
+    {
+        // Let the timer fire anywhere within 5% of the interval
+        const uint64_t slack = std::min<uint64_t>(interval / 20, 500000);
+        prctl(PR_SET_TIMERSLACK, slack * 1000, 0, 0, 0);
+    }
+
+    // Stop at the tick boundary, so the last events are flushed
+    struct sigaction sa = {};
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    StatusTracker tracker(samples.size(), debounce);
+    std::optional<AnomalyDetector> detector;
+    if (anomalyThreshold > 0)
+    {
+        detector.emplace(samples.size(), anomalyThreshold, anomalyWindow);
+    }
+    bool initial = true;
+    uint64_t next = monotonicUsec();
+    while (true)
+    {
+        time_t t;
+        time(&t);
+        try
+        {
+            fetcher.fetch(samples);
+            for (size_t i = 0; i < samples.size(); ++i)
+            {
+                if (fetcher.failed(i) && !fetcher.timedOut(i) &&
+                    !revalidate(samples[i]))
+                {
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+        catch (const sdbusplus::exception::SdBusError& ex)
+        {
+            if (!isConnectionLost(ex))
+            {
+                fprintf(stderr, "Error: %s\n", ex.what());
+                return EXIT_FAILURE;
+            }
+            if (!restoreBus([] { return pendingSignal != 0; }))
+            {
+                fflush(stdout);
+                return EXIT_SUCCESS;
+            }
+            printWatchGap(t, time(nullptr));
+            fflush(stdout);
+            // The states are kept, the transitions made during the gap are
+            // reported on the next sample
+            continue;
+        }
+
+        const uint64_t now = monotonicUsec();
+        bool printed = false;
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            const Status state = fetcher.failed(i) ? Status::unavailable
+                                                   : samples[i].props.state();
+            const auto from = tracker.update(i, state, now);
+            if (from || (initial && state != Status::ok))
+            {
+                printEvent(t, samples[i], from, state);
+                printed = true;
+            }
+        }
+        initial = false;
+        if (detector)
+        {
+            printAnomalies(*detector, t, samples);
+            printed = true;
+        }
+        if (printed && fflush(stdout) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+        if (showStats)
+        {
+            fetcher.printStats(stderr);
+        }
+
+        // Keep the schedule, but never try to catch up the missed ticks
+        next = std::max(next + interval, monotonicUsec());
+        sleepUntil(next);
+        if (pendingSignal)
+        {
+            fflush(stdout);
+            return EXIT_SUCCESS;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Compact per-sensor record of the value updates
+ */
+struct Freshness
+{
+    // Number of Value updates received
+    uint32_t updates = 0;
+    // Number of updates that changed the value
+    uint32_t changes = 0;
+    // Last known value
+    PropertyValue value;
+    bool known = false;
+    // Monotonic time of the last value change, us (0 - never changed)
+    uint64_t lastChange = 0;
+};
+
+/**
+ * @brief Audit the sensors freshness.
+ *
+ * Subscribes to the Value changes of all sensors and collects them during
+ * the window. Sensors that have not sent any update are reported as STALE,
+ * sensors that keep sending the same value as STUCK, if that lasts at least
+ * \p stale_after seconds. The values are polled again at the end of the
+ * window, so the sensors changing without the signals are not reported.
+ *
+ * @param objects     - List of all sensors in the system
+ * @param root_path   - Sensors root path
+ * @param window      - Audit duration, seconds
+ * @param stale_after - Expected maximal period between value changes, seconds
+ * @param fetcher     - Sensors properties fetcher
+ * @return exit status
+ */
+static int auditSensors(const Objects& objects, const std::string& root_path,
+                        unsigned window, unsigned stale_after,
+                        Fetcher& fetcher)
+{
+    Samples samples;
+    for (const auto& obj : objects)
+    {
+        for (const auto& service : obj.second)
+        {
+            samples.push_back({obj.first, service.first, {}, {}});
+        }
+    }
+
+    // The signals come from the unique names of the services owners, the
+    // same path may be served by several of them
+    std::map<Service, std::string> owners;
+    std::vector<Freshness> records(samples.size());
+    std::map<std::pair<std::string_view, std::string_view>, size_t> index;
+    std::vector<bool> keyed(samples.size(), false);
+    // The services not on the bus are resolved again during the window
+    size_t unkeyed = samples.size();
+    const auto keyOwners = [&]() {
+        resolveOwners(samples, owners);
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            auto it = owners.find(samples[i].service);
+            if (keyed[i] || it == owners.end())
+            {
+                continue;
+            }
+            index.emplace(std::make_pair(std::string_view(it->second),
+                                         std::string_view(samples[i].path)),
+                          i);
+            keyed[i] = true;
+            --unkeyed;
+        }
+    };
+    keyOwners();
+
+    // Subscribe before the initial sweep to not miss anything
+    const std::string rule =
+        "type='signal',interface='" + std::string(SYSTEMD_PROPERTIES) +
+        "',member='PropertiesChanged',path_namespace='" + root_path +
+        "',arg0='" SENSOR_VALUE_IFACE "'";
+    const uint64_t start = monotonicUsec();
+    Properties changed;
+    sdbusplus::bus::match::match match(
+        bus(), rule, [&](sdbusplus::message::message& m) {
+            const char* sender = m.get_sender();
+            const char* path = m.get_path();
+            auto it = index.end();
+            if (sender && path)
+            {
+                it = index.find({sender, path});
+            }
+            const char* iface;
+            changed.clear();
+            if (it == index.end() ||
+                sd_bus_message_read_basic(m.get(), SD_BUS_TYPE_STRING,
+                                          &iface) < 0 ||
+                decodeProperties(m.get(), changed) < 0)
+            {
+                return;
+            }
+            // The record outlives the message, so only numbers are kept
+            auto value = changed.find("Value");
+            if (value == changed.end() ||
+                std::holds_alternative<std::string_view>(value->second))
+            {
+                return;
+            }
+
+            Freshness& rec = records[it->second];
+            ++rec.updates;
+            if (!rec.known || rec.value != value->second)
+            {
+                ++rec.changes;
+                rec.value = value->second;
+                rec.known = true;
+                rec.lastChange = monotonicUsec();
+            }
+        });
+
+    try
+    {
+        fetcher.fetch(samples);
+    }
+    catch (const sdbusplus::exception::SdBusError& ex)
+    {
+        fprintf(stderr, "Error: %s\n", ex.what());
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        auto it = samples[i].props.find("Value");
+        if (it != samples[i].props.end() && !records[i].changes)
+        {
+            records[i].value = it->second;
+            records[i].known = true;
+        }
+    }
+
+    fprintf(stderr, "Collecting sensors updates for %u seconds...\n",
+            window);
+    const uint64_t end = start + window * 1000000ull;
+    uint64_t now;
+    uint64_t retry = monotonicUsec() + 1000000;
+    while ((now = monotonicUsec()) < end)
+    {
+        if (unkeyed && now >= retry)
+        {
+            keyOwners();
+            retry = now + 1000000;
+        }
+        const int rc = sd_bus_process(bus().get_bus(), nullptr);
+        if (rc < 0)
+        {
+            fprintf(stderr, "Error: %s\n", strerror(-rc));
+            return EXIT_FAILURE;
+        }
+        if (rc == 0)
+        {
+            sd_bus_wait(bus().get_bus(),
+                        (unkeyed ? std::min(end, retry) : end) - now);
+        }
+    }
+
+    // Not every service emits the signals, such values are compared with
+    // the initial ones
+    try
+    {
+        fetcher.fetch(samples);
+    }
+    catch (const sdbusplus::exception::SdBusError& ex)
+    {
+        fprintf(stderr, "Error: %s\n", ex.what());
+        return EXIT_FAILURE;
+    }
+    now = monotonicUsec();
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        Freshness& rec = records[i];
+        auto it = samples[i].props.find("Value");
+        if (it != samples[i].props.end() &&
+            !std::holds_alternative<std::string_view>(it->second) &&
+            rec.known && rec.value != it->second)
+        {
+            // The change time is unknown, the value is fresh anyway
+            ++rec.changes;
+            rec.value = it->second;
+            rec.lastChange = now;
+        }
+    }
+
+    constexpr auto row_fmt = "%-19.19s %-12.12s %8s %9s %12s  %s\n";
+    printf(row_fmt, "Name", "Type", "Updates", "Rate/min", "Last change",
+           "Freshness");
+    printf("\n");
+    const double minutes = (now - start) / 60e6;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        const Sample& sample = samples[i];
+        const Freshness& rec = records[i];
+        const size_t name_pos = sample.path.rfind('/');
+        const size_t folder_pos = sample.path.rfind('/', name_pos - 1);
+        const std::string type =
+            sample.path.substr(folder_pos + 1, name_pos - folder_pos - 1);
+
+        // Age of the value, the sensor may have not changed before the audit
+        const uint64_t since = rec.lastChange ? rec.lastChange : start;
+        const double age = (now - since) / 1e6;
+        char age_str[16];
+        snprintf(age_str, sizeof(age_str), "%s%.1f s",
+                 rec.lastChange ? "" : ">", age);
+
+        const char* state = "OK";
+        if (fetcher.failed(i) || sample.props.functional() != "OK")
+        {
+            state = "N/A";
+        }
+        else if (age >= stale_after)
+        {
+            state = rec.updates ? "STUCK" : "STALE";
+        }
+
+        char updates_str[16];
+        char rate_str[16];
+        snprintf(updates_str, sizeof(updates_str), "%u", rec.updates);
+        snprintf(rate_str, sizeof(rate_str), "%.1f",
+                 minutes > 0 ? rec.updates / minutes : 0.0);
+        printf(row_fmt, sample.path.c_str() + name_pos + 1, type.c_str(),
+               updates_str, rate_str, age_str, state);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Column of the batch query answer
+ */
+struct BatchColumn
+{
+    const char* name;
+    // The value comes from the fetched properties
+    bool property;
+    std::string (*get)(const Sample& sample);
+};
+
+static const BatchColumn batchColumns[] = {
+    {"name", false,
+     [](const Sample& s) { return s.path.substr(s.path.rfind('/') + 1); }},
+    {"type", false,
+     [](const Sample& s) {
+         const size_t name_pos = s.path.rfind('/');
+         const size_t folder_pos = s.path.rfind('/', name_pos - 1);
+         return s.path.substr(folder_pos + 1, name_pos - folder_pos - 1);
+     }},
+    {"path", false, [](const Sample& s) { return s.path; }},
+    {"service", false, [](const Sample& s) { return s.service; }},
+    {"inventory", false,
+     [](const Sample& s) {
+         return s.inventory.empty()
+                    ? std::string("N/A")
+                    : s.inventory.substr(s.inventory.rfind('/') + 1);
+     }},
+    {"status", true, [](const Sample& s) { return s.props.status(); }},
+    {"value", true, [](const Sample& s) { return trimmed(s.props.value()); }},
+    {"unit", true, [](const Sample& s) { return trimmed(s.props.unit()); }},
+    {"lc", true,
+     [](const Sample& s) { return trimmed(s.props.criticalLow()); }},
+    {"lnc", true,
+     [](const Sample& s) { return trimmed(s.props.warningLow()); }},
+    {"unc", true,
+     [](const Sample& s) { return trimmed(s.props.warningHigh()); }},
+    {"uc", true,
+     [](const Sample& s) { return trimmed(s.props.criticalHigh()); }},
+    {"nr", true, [](const Sample& s) { return trimmed(s.props.fatalHigh()); }},
+};
+
+/**
+ * @brief Single query of the batch
+ */
+struct BatchQuery
+{
+    // Query line as received
+    std::string text;
+    // Sensor types, all if empty
+    std::vector<std::string> types;
+    // Sensor name wildcards, all if empty
+    std::vector<std::string> names;
+    std::vector<const BatchColumn*> columns;
+    // Parsing error, the query is not answered if set
+    std::string error;
+    // Indexes of the selected sensors in the batch samples
+    std::vector<size_t> selected;
+};
+
+/**
+ * @brief Parse the batch query line
+ *
+ * The query is a space-separated list of terms:
+ * type=TYPE[,TYPE...], name=GLOB[,GLOB...] and columns=COLUMN[,COLUMN...].
+ *
+ * @param query - Query with the text to parse
+ */
+static void parseBatchQuery(BatchQuery& query)
+{
+    auto split = [](const std::string& list, std::vector<std::string>& items) {
+        size_t start;
+        size_t end = 0;
+        while ((start = list.find_first_not_of(',', end)) != std::string::npos)
+        {
+            end = list.find(',', start);
+            items.emplace_back(list.substr(start, end - start));
+        }
+    };
+
+    const std::string& text = query.text;
+    std::vector<std::string> columns;
+    size_t start;
+    size_t end = 0;
+    while ((start = text.find_first_not_of(" \t", end)) != std::string::npos)
+    {
+        end = text.find_first_of(" \t", start);
+        const std::string term = text.substr(start, end - start);
+        const size_t eq = term.find('=');
+        const std::string key = term.substr(0, eq);
+        const std::string value =
+            eq == std::string::npos ? std::string() : term.substr(eq + 1);
+        if (key == "type" && !value.empty())
+        {
+            split(value, query.types);
+        }
+        else if (key == "name" && !value.empty())
+        {
+            split(value, query.names);
+        }
+        else if (key == "columns" && !value.empty())
+        {
+            split(value, columns);
+        }
+        else
+        {
+            query.error = "invalid term '" + term + "'";
+            return;
+        }
+    }
+
+    if (columns.empty())
+    {
+        columns = {"name", "status", "value", "unit"};
+    }
+    for (const auto& name : columns)
+    {
+        auto it = std::find_if(
+            std::begin(batchColumns), std::end(batchColumns),
+            [&name](const BatchColumn& col) { return name == col.name; });
+        if (it == std::end(batchColumns))
+        {
+            query.error = "unknown column '" + name + "'";
+            return;
+        }
+        query.columns.push_back(&*it);
+    }
+}
+
+/**
+ * @brief Answer the batch of queries from stdin
+ *
+ * All queries are read first and planned together: the sensors selected by
+ * any of them are fetched once, concurrently, and then each query is answered
+ * with its own block. The block starts with the "### N QUERY" line, then
+ * goes the header and the tab-separated rows, and it ends with an empty line.
+ * Invalid queries are answered with the "error: MESSAGE" line.
+ *
+ * @param topology - All sensors in the system
+ * @param fetcher  - Sensors properties fetcher
+ *
+ * @return exit status
+ */
+static int batchQueries(Topology& topology, Fetcher& fetcher)
+{
+    std::vector<BatchQuery> queries;
+    char* line = nullptr;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, stdin)) >= 0)
+    {
+        std::string text(line, len);
+        text.erase(text.find_last_not_of(" \t\r\n") + 1);
+        if (text.empty() || text[0] == '#')
+        {
+            continue;
+        }
+        queries.emplace_back();
+        queries.back().text = std::move(text);
+        parseBatchQuery(queries.back());
+    }
+    free(line);
+
+    const Samples all = makeSamples(topology);
+    bool inventory = showInventory;
+    std::vector<bool> used(all.size());
+    for (auto& query : queries)
+    {
+        if (!query.error.empty())
+        {
+            continue;
+        }
+        for (size_t i = 0; i < all.size(); ++i)
+        {
+            const std::string& path = all[i].path;
+            const size_t name_pos = path.rfind('/');
+            const size_t folder_pos = path.rfind('/', name_pos - 1);
+            const bool type_match =
+                query.types.empty() ||
+                std::any_of(query.types.begin(), query.types.end(),
+                            [&](const std::string& type) {
+                                return !path.compare(
+                                    folder_pos + 1,
+                                    name_pos - folder_pos - 1, type);
+                            });
+            const bool name_match =
+                query.names.empty() ||
+                std::any_of(query.names.begin(), query.names.end(),
+                            [&](const std::string& glob) {
+                                return !fnmatch(glob.c_str(),
+                                                path.c_str() + name_pos + 1,
+                                                0);
+                            });
+            if (type_match && name_match)
+            {
+                query.selected.push_back(i);
+                used[i] = true;
+            }
+        }
+        for (const auto* col : query.columns)
+        {
+            inventory |= !strcmp(col->name, "inventory");
+        }
+    }
+    if (inventory && !showInventory)
+    {
+        if (!resolveInventory(topology))
+        {
+            fprintf(stderr, "Failed to get the inventory associations\n");
+        }
+    }
+
+    // The union of all queries, every sensor is fetched once
+    Samples samples;
+    std::vector<size_t> position(all.size());
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        if (used[i])
+        {
+            position[i] = samples.size();
+            samples.push_back(all[i]);
+            auto item = topology.inventory.find(all[i].path);
+            if (item != topology.inventory.end())
+            {
+                samples.back().inventory = item->second;
+            }
+        }
+    }
+    try
+    {
+        fetcher.fetch(samples);
+    }
+    catch (const sdbusplus::exception::SdBusError& ex)
+    {
+        fprintf(stderr, "Error: %s\n", ex.what());
+        return EXIT_FAILURE;
+    }
+    if (showStats)
+    {
+        fetcher.printStats(stderr);
+    }
+
+    for (size_t n = 0; n < queries.size(); ++n)
+    {
+        const BatchQuery& query = queries[n];
+        printf("### %zu %s\n", n + 1, query.text.c_str());
+        if (!query.error.empty())
+        {
+            printf("error: %s\n\n", query.error.c_str());
+            continue;
+        }
+        for (size_t c = 0; c < query.columns.size(); ++c)
+        {
+            printf("%s%s", c ? "\t" : "", query.columns[c]->name);
+        }
+        printf("\n");
+        for (const size_t i : query.selected)
+        {
+            const size_t pos = position[i];
+            for (size_t c = 0; c < query.columns.size(); ++c)
+            {
+                const BatchColumn& col = *query.columns[c];
+                const std::string value =
+                    col.property && fetcher.failed(pos)
+                        ? std::string("N/A")
+                        : col.get(samples[pos]);
+                printf("%s%s", c ? "\t" : "", value.c_str());
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Read the snapshot saved in the binary format
+ *
+ * @param file    - Snapshot file name
+ * @param samples - Sensors data storage, sorted by path
+ *
+ * @return false on error
+ */
+static bool readSnapshot(const char* file, Samples& samples)
+{
+    FILE* in = fopen(file, "rb");
+    if (!in)
+    {
+        fprintf(stderr, "Can't open %s: %s\n", file, strerror(errno));
+        return false;
+    }
+
+    BinaryReader reader(in);
+    uint8_t type;
+    time_t timestamp;
+    const bool ok = reader.header() && reader.frame(type) &&
+                    type == FRAME_SNAPSHOT &&
+                    reader.snapshot(timestamp, samples);
+    fclose(in);
+    if (!ok)
+    {
+        fprintf(stderr, "%s is not a valid snapshot\n", file);
+        return false;
+    }
+
+    std::stable_sort(samples.begin(), samples.end(),
+                     [](const Sample& a, const Sample& b) {
+                         return CmpSensorsName()(a.path, b.path);
+                     });
+    return true;
+}
+
+/**
+ * @brief Allowed difference of the sensor values
+ */
+struct Tolerance
+{
+    double value = 0;
+    // The value is a percentage of the old value
+    bool relative = false;
+
+    bool exceeded(double from, double to) const
+    {
+        const double limit = relative ? std::fabs(from) * value / 100 : value;
+        return std::fabs(to - from) > limit;
+    }
+};
+
+/**
+ * @brief Compare two snapshots
+ *
+ * Both snapshots are sorted by path, so the comparison is a single linear
+ * merge pass. Reports added and removed sensors, changes of the status,
+ * units and thresholds, and the value changes beyond the tolerance.
+ *
+ * @param fileA     - Old snapshot file name
+ * @param fileB     - New snapshot file name
+ * @param tolerance - Allowed value difference
+ *
+ * @return 0 if the snapshots are the same, 1 if they differ, 2 on error
+ */
+static int diffSnapshots(const char* fileA, const char* fileB,
+                         const Tolerance& tolerance)
+{
+    Samples a;
+    Samples b;
+    if (!readSnapshot(fileA, a) || !readSnapshot(fileB, b))
+    {
+        return 2;
+    }
+
+    static constexpr const char* thresholds[] = {
+        "CriticalLow", "WarningLow", "WarningHigh", "CriticalHigh",
+        "FatalHigh",
+    };
+    const size_t prefix = strlen(SENSORS_PATH) + 1;
+    auto name = [prefix](const Sample& sample) {
+        return sample.path.c_str() +
+               (sample.path.size() > prefix ? prefix : 0);
+    };
+
+    size_t differences = 0;
+    auto change = [&](const Sample& sample, const char* what,
+                      const std::string& from, const std::string& to) {
+        printf("~ %-40s %-13s %s -> %s\n", name(sample), what, from.c_str(),
+               to.c_str());
+        ++differences;
+    };
+
+    CmpSensorsName less;
+    auto itA = a.begin();
+    auto itB = b.begin();
+    while (itA != a.end() || itB != b.end())
+    {
+        if (itB == b.end() || (itA != a.end() && less(itA->path, itB->path)))
+        {
+            printf("- %s\n", name(*itA));
+            ++differences;
+            ++itA;
+            continue;
+        }
+        if (itA == a.end() || less(itB->path, itA->path))
+        {
+            printf("+ %s\n", name(*itB));
+            ++differences;
+            ++itB;
+            continue;
+        }
+
+        const Properties& from = itA->props;
+        const Properties& to = itB->props;
+        auto format = [](const std::optional<double>& value) {
+            char buf[32] = "N/A";
+            if (value)
+            {
+                snprintf(buf, sizeof(buf), "%.3f", *value);
+            }
+            return std::string(buf);
+        };
+        if (from.status() != to.status())
+        {
+            change(*itA, "Status", from.status(), to.status());
+        }
+        if (from.unit() != to.unit())
+        {
+            change(*itA, "Unit", from.unit(), to.unit());
+        }
+        for (const char* threshold : thresholds)
+        {
+            const auto x = from.number(threshold);
+            const auto y = to.number(threshold);
+            if (x != y)
+            {
+                change(*itA, threshold, format(x), format(y));
+            }
+        }
+        const auto x = from.reading();
+        const auto y = to.reading();
+        if (x.has_value() != y.has_value() ||
+            (x && tolerance.exceeded(*x, *y)))
+        {
+            std::string delta;
+            if (x && y)
+            {
+                char buf[32];
+                snprintf(buf, sizeof(buf), " (%+.3f)", *y - *x);
+                delta = buf;
+            }
+            change(*itA, "Value", format(x), format(y) + delta);
+        }
+        ++itA;
+        ++itB;
+    }
+
+    return differences ? 1 : 0;
+}
+
+#ifdef WITH_REMOTE_HOST
+/**
+ * @brief Quote the argument for the remote shell
+ */
+static std::string shellQuote(const std::string& arg)
+{
+    std::string ret = "'";
+    for (const char chr : arg)
+    {
+        if (chr == '\'')
+        {
+            ret += "'\\''";
+        }
+        else
+        {
+            ret += chr;
+        }
+    }
+    ret += "'";
+    return ret;
+}
+
+/**
+ * @brief Start the lssensors agent on the remote host over ssh
+ *
+ * @param host   - Remote host in the ssh format ([USER@]HOST)
+ * @param remote - Remote command line
+ * @param pid    - Started ssh process id
+ *
+ * @return stream of the agent output or nullptr on failure
+ */
+static FILE* spawnAgent(const char* host, const std::string& remote,
+                        pid_t& pid)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+        return nullptr;
+    }
+
+    pid = fork();
+    if (pid < 0)
+    {
+        fprintf(stderr, "Failed to fork: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return nullptr;
+    }
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        // The host must not be taken for an ssh option
+        execlp("ssh", "ssh", "-T", "-e", "none", "--", host, remote.c_str(),
+               nullptr);
+        fprintf(stderr, "Failed to execute ssh: %s\n", strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+    close(fds[1]);
+
+    FILE* in = fdopen(fds[0], "r");
+    if (!in)
+    {
+        fprintf(stderr, "Failed to open the agent output: %s\n",
+                strerror(errno));
+        close(fds[0]);
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+    return in;
+}
+
+/**
+ * @brief Render the agent's binary stream
+ *
+ * @param reader     - Binary stream decoder
+ * @param watch_mode - Render the stream as the watch mode output
+ *
+ * @return false if the stream is malformed
+ */
+static bool renderStream(BinaryReader& reader, bool watch_mode)
+{
+    uint8_t type;
+    time_t timestamp;
+    time_t resumed;
+    Samples samples;
+    // The anomalies are detected here to keep the agent simple
+    std::optional<AnomalyDetector> detector;
+    std::optional<TrendPredictor> predictor;
+    // Sensors the detector and predictor state is indexed by
+    std::vector<std::string> paths;
+    while (reader.frame(type))
+    {
+        if (type == FRAME_SNAPSHOT && reader.snapshot(timestamp, samples))
+        {
+            if (watch_mode)
+            {
+                const bool changed =
+                    samples.size() != paths.size() ||
+                    !std::equal(samples.begin(), samples.end(), paths.begin(),
+                                [](const Sample& sample,
+                                   const std::string& path) {
+                                    return sample.path == path;
+                                });
+                if (changed)
+                {
+                    detector.reset();
+                    predictor.reset();
+                    paths.clear();
+                    for (const auto& sample : samples)
+                    {
+                        paths.push_back(sample.path);
+                    }
+                }
+                printWatchLine(timestamp, samples);
+                if (anomalyThreshold > 0)
+                {
+                    if (!detector)
+                    {
+                        detector.emplace(samples.size(), anomalyThreshold,
+                                         anomalyWindow);
+                    }
+                    printAnomalies(*detector, timestamp, samples);
+                }
+                if (predictWindow)
+                {
+                    if (!predictor)
+                    {
+                        predictor.emplace(samples.size(), predictWindow);
+                    }
+                    // The timestamps are whole seconds, the local receive
+                    // time is finer
+                    printPredictions(*predictor, monotonicUsec() / 1e6,
+                                     timestamp, samples);
+                }
+                fflush(stdout);
+            }
+            else
+            {
+                printListing(samples);
+            }
+        }
+        else if (type == FRAME_GAP && reader.gap(timestamp, resumed))
+        {
+            printWatchGap(timestamp, resumed);
+            // The history before the gap doesn't predict the values after
+            detector.reset();
+            predictor.reset();
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ssh exit status on the connection errors
+static constexpr int SSH_ERROR_STATUS = 255;
+
+/**
+ * @brief Run the lssensors agent on the remote host over a single ssh session
+ *        and render the received binary stream locally.
+ *
+ * In the watch mode the broken ssh session is restarted with exponential
+ * backoff, the missed period is marked in the output.
+ *
+ * @param host       - Remote host in the ssh format ([USER@]HOST)
+ * @param command    - lssensors command on the remote host
+ * @param args       - Arguments passed to the remote lssensors
+ * @param watch_mode - Render the stream as the watch mode output
+ *
+ * @return exit status
+ */
+static int runRemoteAgent(const char* host, const std::string& command,
+                          const std::vector<std::string>& args,
+                          bool watch_mode)
+{
+    std::string remote = command + " --format=binary --stdout-agent";
+    for (const auto& arg : args)
+    {
+        remote += ' ';
+        remote += shellQuote(arg);
+    }
+
+    time_t lost = 0;
+    useconds_t delay = RECONNECT_MIN_DELAY;
+    while (true)
+    {
+        pid_t pid;
+        FILE* in = spawnAgent(host, remote, pid);
+        if (!in)
+        {
+            return EXIT_FAILURE;
+        }
+
+        BinaryReader reader(in);
+        int rc = EXIT_SUCCESS;
+        const bool valid = reader.header();
+        if (valid)
+        {
+            if (lost)
+            {
+                printWatchGap(lost, time(nullptr));
+                fprintf(stderr, "Connection to %s restored\n", host);
+                lost = 0;
+                delay = RECONNECT_MIN_DELAY;
+            }
+            if (!renderStream(reader, watch_mode))
+            {
+                fprintf(stderr, "Malformed data from the remote agent\n");
+                rc = EXIT_FAILURE;
+            }
+        }
+        fclose(in);
+
+        int status;
+        if (waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+            WEXITSTATUS(status) != EXIT_SUCCESS)
+        {
+            rc = WEXITSTATUS(status);
+        }
+
+        if (!watch_mode || rc != SSH_ERROR_STATUS)
+        {
+            if (!valid)
+            {
+                fprintf(stderr, "Unexpected response from the remote agent\n");
+                return rc == EXIT_SUCCESS ? EXIT_FAILURE : rc;
+            }
+            return rc;
+        }
+
+        if (!lost)
+        {
+            lost = time(nullptr);
+            fprintf(stderr, "Connection to %s lost, reconnecting...\n", host);
+        }
+        usleep(delay);
+        delay = std::min(delay * 2, RECONNECT_MAX_DELAY);
+    }
+}
+#endif
+
+/**
+ * @brief Sensors discovery method
+ */
+enum class Discovery
+{
+    // Ask the mapper, ask the services if the mapper fails
+    automatic,
+    // Ask the mapper only
+    mapper,
+    // Ask the services for their objects
+    managed,
+};
+
+// Mapper timeout before asking the services directly, us
+static constexpr uint64_t MAPPER_TIMEOUT = 5000000;
+
+/**
+ * @brief Read the whole cache file
+ *
+ * @param file - Cache file name in the cache directory
+ *
+ * @return file content, empty if there is no such file
+ */
+static std::string readCache(const std::string& file)
+{
+    std::string ret;
+    FILE* in = fopen((CACHE_DIR "/" + file).c_str(), "rb");
+    if (in)
+    {
+        char buf[4096];
+        size_t len;
+        while ((len = fread(buf, 1, sizeof(buf), in)) > 0)
+        {
+            ret.append(buf, len);
+        }
+        fclose(in);
+    }
+    return ret;
+}
+
+/**
+ * @brief Replace the cache file atomically
+ *
+ * The cache is an optimization only, so the failures are ignored.
+ *
+ * @param file - Cache file name in the cache directory
+ * @param data - New content
+ */
+static void writeCache(const std::string& file, const std::string& data)
+{
+    mkdir(CACHE_DIR, 0755);
+    const std::string path = CACHE_DIR "/" + file;
+    const std::string temp = path + ".tmp." + std::to_string(getpid());
+    FILE* out = fopen(temp.c_str(), "wb");
+    if (!out)
+    {
+        return;
+    }
+    const bool written = fwrite(data.data(), 1, data.size(), out) ==
+                         data.size();
+    if (fclose(out) != 0 || !written || rename(temp.c_str(), path.c_str()))
+    {
+        unlink(temp.c_str());
+    }
+}
+
+/**
+ * @brief Get the cache file name for the connected host
+ *
+ * @param name - Cache name
+ */
+static std::string cacheFile(std::string name)
+{
+    if (!cacheHost.empty())
+    {
+        name += '@' + cacheHost;
+        std::replace(name.begin(), name.end(), '/', '_');
+    }
+    return name;
+}
+
+/**
+ * @brief Get the cache file of the sensors layout
+ *
+ * @param type - Sensors type, empty for all sensors
+ */
+static std::string topologyCache(const std::string& type)
+{
+    return cacheFile("topology-" + (type.empty() ? std::string("all") : type));
+}
+
+/**
+ * @brief Serialize the sensors layout, a "service path" line per sensor
+ */
+static std::string formatTopology(const Topology& topology)
+{
+    std::string ret;
+    for (const auto& obj : topology.objects)
+    {
+        for (const auto& service : obj.second)
+        {
+            ret += service.first + ' ' + obj.first + '\n';
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Make the samples of the serialized sensors layout
+ */
+static Samples parseTopology(const std::string& data)
+{
+    Samples samples;
+    size_t start = 0;
+    size_t end;
+    while ((end = data.find('\n', start)) != std::string::npos)
+    {
+        const size_t sep = data.find(' ', start);
+        if (sep < end)
+        {
+            samples.push_back({data.substr(sep + 1, end - sep - 1),
+                               data.substr(start, sep - start),
+                               {},
+                               {}});
+        }
+        start = end + 1;
+    }
+    return samples;
+}
+
+/**
+ * @brief Split the comma-separated list
+ *
+ * @param list  - List to split
+ * @param items - Items to append to
+ */
+static void splitList(const std::string& list, std::vector<std::string>& items)
+{
+    size_t start;
+    size_t end = 0;
+    while ((start = list.find_first_not_of(',', end)) != std::string::npos)
+    {
+        end = list.find(',', start);
+        items.emplace_back(list.substr(start, end - start));
+    }
+}
+
+/**
+ * @brief Parse the unsigned number option argument
+ *
+ * @param arg   - Option argument
+ * @param value - Parsed value storage
+ *
+ * @return false if the argument is not a number
+ */
+static bool parseNumber(const char* arg, unsigned& value)
+{
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long num = strtoul(arg, &end, 10);
+    if (errno || end == arg || *end || num > UINT_MAX)
+    {
+        return false;
+    }
+    value = static_cast<unsigned>(num);
+    return true;
+}
+
+/**
+ * @brief Interactive session answering the commands from stdin.
+ *
+ * The bus connection, the discovered topology and the services of the
+ * sensors are kept between the commands. The topology is invalidated by the
+ * signals of the sensors appearing or disappearing and of the sensor services
+ * leaving the bus, and it is rediscovered on the next command that needs it.
+ *
+ * When stdin is not a terminal, every answer is terminated with the line
+ * containing a single dot, so the session can be used as a coprocess.
+ */
+class Repl
+{
+  public:
+    explicit Repl(Fetcher& fetcher) :
+        fetcher(fetcher), interactive(isatty(STDIN_FILENO))
+    {
+    }
+
+    /**
+     * @brief Run the commands until the end of input or the quit command
+     *
+     * @return exit status
+     */
+    int run()
+    {
+        subscribe();
+
+        std::string line;
+        while (true)
+        {
+            if (interactive)
+            {
+                printf("lssensors> ");
+                fflush(stdout);
+            }
+            if (!readLine(line))
+            {
+                break;
+            }
+
+            std::vector<std::string> args;
+            size_t start;
+            size_t end = 0;
+            while ((start = line.find_first_not_of(" \t", end)) !=
+                   std::string::npos)
+            {
+                end = line.find_first_of(" \t", start);
+                args.emplace_back(line.substr(start, end - start));
+            }
+            if (args.empty())
+            {
+                continue;
+            }
+            if (args[0] == "quit" || args[0] == "exit")
+            {
+                break;
+            }
+
+            try
+            {
+                execute(args);
+            }
+            catch (const sdbusplus::exception::SdBusError& ex)
+            {
+                if (!isConnectionLost(ex))
+                {
+                    fprintf(stderr, "Error: %s\n", ex.what());
+                }
+                else
+                {
+                    restoreBus();
+                    subscribe();
+                    fprintf(stderr, "Connection was lost, try again\n");
+                }
+            }
+            if (!interactive)
+            {
+                printf(".\n");
+            }
+            fflush(stdout);
+        }
+        return EXIT_SUCCESS;
+    }
+
+  private:
+    /**
+     * @brief Execute the single command
+     *
+     * @param args - Command and its arguments
+     */
+    void execute(const std::vector<std::string>& args)
+    {
+        const std::string& cmd = args[0];
+        if (cmd == "list" && args.size() <= 2)
+        {
+            list(args.size() == 2 ? args[1] : std::string());
+        }
+        else if (cmd == "show" && args.size() == 2)
+        {
+            show(args[1]);
+        }
+        else if (cmd == "watch" && args.size() >= 2 && args.size() <= 4)
+        {
+            double interval = 1;
+            unsigned count = 0;
+            char* end = nullptr;
+            if (args.size() > 2)
+            {
+                interval = strtod(args[2].c_str(), &end);
+            }
+            if ((end && (*end || !(interval >= 0.001))) ||
+                (args.size() > 3 && !parseNumber(args[3].c_str(), count)))
+            {
+                fprintf(stderr, "Invalid watch interval or count!\n");
+                return;
+            }
+            watch(args[1], interval, count);
+        }
+        else if (cmd == "refresh" && args.size() == 1)
+        {
+            stale = true;
+        }
+        else
+        {
+            fprintf(stderr,
+                    "Commands:\n"
+                    "  list [TYPE]                    Show sensors of "
+                    "the type or all sensors\n"
+                    "  show NAME                      Show single sensor\n"
+                    "  watch NAMES [SECS [COUNT]]     Print sensors values "
+                    "(comma-separated\n"
+                    "                                 list) until any input "
+                    "or COUNT lines\n"
+                    "  refresh                        Rediscover the "
+                    "sensors\n"
+                    "  quit                           End the session\n");
+        }
+    }
+
+    /**
+     * @brief Show all sensors of the type
+     */
+    void list(const std::string& type)
+    {
+        if (!update())
+        {
+            return;
+        }
+        Samples selected;
+        for (const auto& sample : samples)
+        {
+            if (type.empty() || typeOf(sample.path) == type)
+            {
+                selected.push_back(sample);
+            }
+        }
+        if (selected.empty())
+        {
+            fprintf(stderr, "No sensors of selected type are present\n");
+            return;
+        }
+        print(selected);
+    }
+
+    /**
+     * @brief Show single sensor
+     */
+    void show(const std::string& name)
+    {
+        Samples selected;
+        if (find(name, selected))
+        {
+            print(selected);
+        }
+    }
+
+    /**
+     * @brief Print the sensors values periodically
+     *
+     * @param names    - Comma-separated list of sensor names
+     * @param interval - Interval between lines, seconds
+     * @param count    - Number of lines, 0 - until any input
+     */
+    void watch(const std::string& names, double interval, unsigned count)
+    {
+        Samples selected;
+        size_t start;
+        size_t end = 0;
+        while ((start = names.find_first_not_of(',', end)) !=
+               std::string::npos)
+        {
+            end = names.find(',', start);
+            if (!find(names.substr(start, end - start), selected))
+            {
+                return;
+            }
+        }
+
+        const uint64_t period = static_cast<uint64_t>(interval * 1e6);
+        uint64_t next = monotonicUsec();
+        for (unsigned line = 0; !count || line < count; ++line)
+        {
+            time_t t;
+            time(&t);
+            fetcher.fetch(selected);
+            printWatchLine(t, selected);
+            fflush(stdout);
+
+            next += period;
+            const uint64_t now = monotonicUsec();
+            if (line + 1 != count && wait(next > now ? next - now : 0))
+            {
+                // Stop on any input, it is the next command
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief Find all instances of the sensor by its name
+     *
+     * @param name     - Sensor name
+     * @param selected - Samples to append the found sensor to
+     *
+     * @return false if the sensor is not found
+     */
+    bool find(const std::string& name, Samples& selected)
+    {
+        if (!update())
+        {
+            return false;
+        }
+        bool found = false;
+        for (const auto& sample : samples)
+        {
+            if (!sample.path.compare(sample.path.rfind('/') + 1,
+                                     std::string::npos, name))
+            {
+                selected.push_back(sample);
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            fprintf(stderr, "Failed to find sensor %s!\n", name.c_str());
+        }
+        return found;
+    }
+
+    /**
+     * @brief Fetch and show the sensors
+     */
+    void print(Samples& selected)
+    {
+        fetcher.fetch(selected);
+        shownType.clear();
+        for (size_t i = 0; i < selected.size(); ++i)
+        {
+            if (fetcher.timedOut(i))
+            {
+                fprintf(stderr, "%s was not fetched in time\n",
+                        selected[i].path.c_str());
+            }
+            else if (fetcher.failed(i))
+            {
+                fprintf(stderr, "Get properties for %s failed\n",
+                        selected[i].path.c_str());
+                // The service may have been replaced
+                stale = true;
+            }
+            else
+            {
+                printSensorData(selected[i]);
+            }
+        }
+        if (showStats)
+        {
+            fetcher.printStats(stderr);
+        }
+    }
+
+    /**
+     * @brief Rediscover the sensors if the cached topology is invalidated
+     *
+     * @return false if there are no sensors
+     */
+    bool update()
+    {
+        if (!stale)
+        {
+            return true;
+        }
+        Topology topology;
+        try
+        {
+            discover(sensorsPath(), topology);
+        }
+        catch (const sdbusplus::exception::SdBusError& ex)
+        {
+            if (strcmp(ex.name(), "org.freedesktop.DBus.Error.FileNotFound"))
+            {
+                throw;
+            }
+        }
+        if (showInventory)
+        {
+            if (!resolveInventory(topology))
+            {
+                fprintf(stderr, "Failed to get the inventory associations\n");
+            }
+        }
+        samples = makeSamples(topology);
+        services.clear();
+        for (const auto& sample : samples)
+        {
+            services.insert(sample.service);
+        }
+        stale = false;
+        if (samples.empty())
+        {
+            fprintf(stderr, "No sensors are present\n");
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Subscribe to the signals invalidating the topology
+     */
+    void subscribe()
+    {
+        matches.clear();
+        stale = true;
+
+        const std::string objects =
+            "type='signal',interface='org.freedesktop.DBus.ObjectManager',"
+            "arg0path='" SENSORS_PATH "/',member=";
+        auto invalidate = [this](sdbusplus::message::message&) {
+            stale = true;
+        };
+        matches.emplace_back(bus(), objects + "'InterfacesAdded'",
+                             invalidate);
+        matches.emplace_back(bus(), objects + "'InterfacesRemoved'",
+                             invalidate);
+        matches.emplace_back(
+            bus(),
+            "type='signal',sender='org.freedesktop.DBus',"
+            "interface='org.freedesktop.DBus',member='NameOwnerChanged'",
+            [this](sdbusplus::message::message& m) {
+                const char* name;
+                if (sd_bus_message_read_basic(m.get(), SD_BUS_TYPE_STRING,
+                                              &name) >= 0 &&
+                    services.count(name))
+                {
+                    stale = true;
+                }
+            });
+    }
+
+    /**
+     * @brief Wait for the input, handling the bus signals meanwhile
+     *
+     * @param timeout - Wait limit, us (UINT64_MAX - infinite)
+     *
+     * @return true if there is input to read
+     */
+    bool wait(uint64_t timeout)
+    {
+        const uint64_t deadline =
+            timeout == UINT64_MAX ? UINT64_MAX : monotonicUsec() + timeout;
+        while (true)
+        {
+            if (!input.empty() || eof)
+            {
+                return true;
+            }
+            // Signals may have been queued while waiting for method replies
+            while (sd_bus_process(bus().get_bus(), nullptr) > 0)
+            {
+            }
+
+            const uint64_t now = monotonicUsec();
+            if (now >= deadline)
+            {
+                return false;
+            }
+            // The bus may need to write the queued messages or to time out
+            // the pending calls
+            sd_bus* conn = bus().get_bus();
+            const int events = sd_bus_get_events(conn);
+            uint64_t wake = deadline;
+            uint64_t bus_timeout;
+            if (sd_bus_get_timeout(conn, &bus_timeout) >= 0)
+            {
+                wake = std::min(wake, bus_timeout);
+            }
+            int wait_ms = -1;
+            if (wake != UINT64_MAX)
+            {
+                wait_ms = wake > now
+                              ? static_cast<int>(std::min<uint64_t>(
+                                    (wake - now + 999) / 1000, INT_MAX))
+                              : 0;
+            }
+            struct pollfd fds[2] = {
+                {STDIN_FILENO, POLLIN, 0},
+                {sd_bus_get_fd(conn),
+                 static_cast<short>(events > 0 ? events : POLLIN), 0},
+            };
+            if (poll(fds, 2, wait_ms) < 0 && errno != EINTR)
+            {
+                eof = true;
+            }
+            else if (fds[0].revents)
+            {
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @brief Read the next command line
+     *
+     * @return false at the end of input
+     */
+    bool readLine(std::string& line)
+    {
+        size_t pos;
+        while ((pos = input.find('\n')) == std::string::npos)
+        {
+            if (eof)
+            {
+                if (input.empty())
+                {
+                    return false;
+                }
+                pos = input.size();
+                input += '\n';
+                break;
+            }
+            wait(UINT64_MAX);
+
+            char buf[256];
+            const ssize_t len = read(STDIN_FILENO, buf, sizeof(buf));
+            if (len > 0)
+            {
+                input.append(buf, len);
+            }
+            else if (len == 0 || errno != EINTR)
+            {
+                eof = true;
+            }
+        }
+        line = input.substr(0, pos);
+        input.erase(0, pos + 1);
+        return true;
+    }
+
+    /**
+     * @brief Get the sensor type from its path
+     */
+    static std::string typeOf(const std::string& path)
+    {
+        const size_t name_pos = path.rfind('/');
+        const size_t folder_pos = path.rfind('/', name_pos - 1);
+        return path.substr(folder_pos + 1, name_pos - folder_pos - 1);
+    }
+
+    Fetcher& fetcher;
+    // Prompt the user instead of terminating the answers
+    bool interactive;
+    // Cached sensors, in the natural order
+    Samples samples;
+    // Services providing the cached sensors
+    std::set<std::string> services;
+    // The cached sensors must be rediscovered
+    bool stale = true;
+    std::vector<sdbusplus::bus::match::match> matches;
+    // Input received but not processed yet
+    std::string input;
+    bool eof = false;
+};
+
+/**
+ * @brief Prints the application usage help
+ *
+ * @return EXIT_FAILURE
+ */
+static int usage(char *progname, bool cli_mode)
+{
+    if (cli_mode)
+    {
+        fprintf(stderr, "Sensor readings\n"
+                        "  [TYPE] - An optional type of sensors to list\n"
+                        "           Available types are:\n"
+                        "             voltage\n"
+                        "             current\n"
+                        "             power\n"
+                        "             temperature\n"
+                        "             fan_pwm\n"
+                        "             fan_tach\n"
+                        "  Options:\n"
+                        "      -C, --color              Enable colors\n"
+                        "      -w, --watch <sensors>    Print sensors values "
+                        "each n seconds (comma-separated list)\n"
+                        "      -n, --interval <secs>    Seconds to wait "
+                        "between updates in watch mode\n");
+    }
+    else
+    {
+        fprintf(stderr,
+                "Usage: %s [options] [sensors-type]\n"
+                "  Shows all sensors of the specified type.\n"
+                "  If the type is not specified shows all found sensors.\n"
+                "Options:\n"
+#ifdef WITH_REMOTE_HOST
+                "  -H, --host=[USER@]HOST   Operate on remote host (over ssh)\n"
+                "  -A, --agent              Run lssensors on the remote host "
+                "and\n"
+                "                           receive its data in one stream\n"
+#endif
+                "  -c, --cli                CLI mode for obmc-yadro-cli\n"
+                "  -C, --color              Enable colors\n"
+                "  -w, --watch <sensors>    Print sensors values each n "
+                "seconds (comma-separated list),\n"
+                "                           read the commands from the "
+                "terminal:\n"
+                "                           +/- interval, p pause, a/r "
+                "<sensor> add/remove\n"
+                "  -n, --interval <secs>    Seconds to wait between updates in "
+                "watch mode\n"
+                "      --format=text|binary Output format\n"
+                "      --stdout-agent       Run as the remote agent: stream "
+                "binary\n"
+                "                           data to stdout\n"
+                "      --stats[=alloc]      Print the bus load or the heap "
+                "allocations\n"
+                "                           statistics\n"
+                "      --max-inflight <n>   Outstanding requests limit per "
+                "service\n"
+                "      --rate <n>           Requests per second limit (0 - "
+                "unlimited)\n"
+                "      --timeout <ms>       Sweep timeout, show what is fetched "
+                "in time\n"
+                "                           (at most the interval when "
+                "watching)\n"
+                "      --priority <list>    Fetch order criteria: tag, status, "
+                "type\n"
+                "                           or none (default: "
+                "tag,status,type)\n"
+                "      --tag <sensors>      Fetch these sensors first "
+                "(comma-separated\n"
+                "                           list, wildcards allowed)\n"
+                "      --low-overhead       Minimize wakeups and CPU usage in "
+                "watch mode\n"
+                "      --cpu-budget <pct>   Stretch the watch interval to keep "
+                "CPU usage\n"
+                "                           under the limit\n"
+                "      --report <secs>      Report own overhead each n seconds "
+                "in watch\n"
+                "                           mode (default: 600 with "
+                "--low-overhead)\n"
+                "      --cpu <n>            Pin the watch sampler to the CPU\n"
+                "      --rt-prio <n>        Run the watch sampler with "
+                "SCHED_FIFO priority\n"
+                "      --nice <n>           Run the watch sampler with the nice "
+                "value\n"
+                "      --mlock              Lock the sampler memory\n"
+                "      --jitter             Report the tick wakeup jitter "
+                "histogram\n"
+                "      --audit <secs>       Watch sensors updates for n "
+                "seconds and\n"
+                "                           report stale and stuck sensors\n"
+                "      --stale-after <secs> Expected maximal period between "
+                "value\n"
+                "                           changes (default: audit window)\n"
+                "      --histogram[=json]   Collect watched values "
+                "distribution, print\n"
+                "                           it on SIGUSR1 and on exit\n"
+                "      --snapshot <file>    Save sensors in the binary format "
+                "(same as\n"
+                "                           --format=binary output)\n"
+                "      --diff <a> <b>       Compare two snapshots, exit status "
+                "is 1 if\n"
+                "                           they differ\n"
+                "      --tolerance <n[%%]>   Ignore value changes within the "
+                "tolerance\n"
+                "      --inventory          Show the inventory item of each "
+                "sensor\n"
+                "      --repl               Answer the commands from stdin "
+                "over one\n"
+                "                           connection, 'help' lists "
+                "the commands\n"
+                "      --batch              Answer the queries from stdin, "
+                "one per line:\n"
+                "                           [type=TYPES] [name=GLOBS] "
+                "[columns=COLUMNS]\n"
+                "      --discovery=auto|mapper|managed\n"
+                "                           Discover sensors with the mapper, "
+                "by asking\n"
+                "                           the services directly or the "
+                "latter if\n"
+                "                           the mapper fails (default)\n"
+                "      --services <globs>   Services to ask without the "
+                "mapper\n"
+                "      --events             Print only the sensors state "
+                "changes, of\n"
+                "                           the -w sensors or all sensors\n"
+                "      --debounce <n>       Accept the new state after n "
+                "samples\n"
+                "      --dwell <secs>       Accept the new state after it "
+                "lasts secs\n"
+                "      --anomaly <z>        Report the watched values "
+                "deviating from\n"
+                "                           the recent mean by z standard "
+                "deviations\n"
+                "      --anomaly-window <n> Samples to average over (default: "
+                "60)\n"
+                "      --hwmon[=<map>]      Read the watched local sensors "
+                "from hwmon,\n"
+                "                           matched by labels or by the map "
+                "file\n"
+                "      --hwmon-root <dir>   Hwmon class directory (default: "
+                "%s)\n"
+                "      --predict <n>        Show when the watched sensors "
+                "reach their\n"
+                "                           thresholds, fitting the last n "
+                "values\n"
+                "      --horizon <secs>     Longest prediction to show "
+                "(default: 600)\n"
+                "      --no-cache           Do not remember the sensors "
+                "layout, static\n"
+                "                           properties and the unavailable "
+                "ones\n"
+                "      --summary[=footer]   Show count, min/max/mean and "
+                "statuses per\n"
+                "                           type instead of (or after) the "
+                "tables\n"
+                "  -h, --help               Show this help\n",
+                progname, HWMON_ROOT);
+    }
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief Application entry point
+ *
+ * @return
+ */
+int main(int argc, char* argv[])
+{
+#ifdef WITH_REMOTE_HOST
+    const char* host = nullptr;
+    bool use_agent = false;
+#endif
+    bool showhelp = false;
+    bool cli_mode = false;
+    bool repl_mode = false;
+    bool batch_mode = false;
+    bool watch_mode = false;
+    bool events_mode = false;
+    StatusTracker::Debounce debounce;
+    std::vector<std::string> watch_list;
+    WatchOptions watch;
+    bool report_set = false;
+    unsigned audit_window = 0;
+    unsigned stale_after = 0;
+    const char* snapshot_file = nullptr;
+    const char* diff_file = nullptr;
+    Tolerance tolerance;
+    Fetcher::Limits limits;
+    FetchPriority priority;
+    Discovery discovery = Discovery::automatic;
+    std::vector<std::string> services;
+    splitList(DISCOVERY_SERVICES, services);
+
+    // Long options without short equivalents
+    enum
+    {
+        OPT_FORMAT = 0x100,
+        OPT_STDOUT_AGENT,
+        OPT_STATS,
+        OPT_MAX_INFLIGHT,
+        OPT_RATE,
+        OPT_TIMEOUT,
+        OPT_PRIORITY,
+        OPT_TAG,
+        OPT_LOW_OVERHEAD,
+        OPT_CPU_BUDGET,
+        OPT_REPORT,
+        OPT_CPU,
+        OPT_RT_PRIO,
+        OPT_NICE,
+        OPT_MLOCK,
+        OPT_JITTER,
+        OPT_AUDIT,
+        OPT_STALE_AFTER,
+        OPT_HISTOGRAM,
+        OPT_SNAPSHOT,
+        OPT_DIFF,
+        OPT_TOLERANCE,
+        OPT_INVENTORY,
+        OPT_REPL,
+        OPT_BATCH,
+        OPT_DISCOVERY,
+        OPT_SERVICES,
+        OPT_SUMMARY,
+        OPT_EVENTS,
+        OPT_DEBOUNCE,
+        OPT_DWELL,
+        OPT_ANOMALY,
+        OPT_ANOMALY_WINDOW,
+        OPT_PREDICT,
+        OPT_HWMON,
+        OPT_NO_CACHE,
+        OPT_HWMON_ROOT,
+        OPT_HORIZON,
+    };
+
+    const struct option opts[] = {
+#ifdef WITH_REMOTE_HOST
+        {"host", required_argument, nullptr, 'H'},
+        {"agent", no_argument, nullptr, 'A'},
+#endif
+        {"cli", no_argument, nullptr, 'c'},
         {"color", no_argument, nullptr, 'C'},
         {"watch", required_argument, nullptr, 'w'},
         {"interval", required_argument, nullptr, 'n'},
+        {"format", required_argument, nullptr, OPT_FORMAT},
+        {"stdout-agent", no_argument, nullptr, OPT_STDOUT_AGENT},
+        {"stats", optional_argument, nullptr, OPT_STATS},
+        {"max-inflight", required_argument, nullptr, OPT_MAX_INFLIGHT},
+        {"rate", required_argument, nullptr, OPT_RATE},
+        {"timeout", required_argument, nullptr, OPT_TIMEOUT},
+        {"priority", required_argument, nullptr, OPT_PRIORITY},
+        {"tag", required_argument, nullptr, OPT_TAG},
+        {"low-overhead", no_argument, nullptr, OPT_LOW_OVERHEAD},
+        {"cpu-budget", required_argument, nullptr, OPT_CPU_BUDGET},
+        {"report", required_argument, nullptr, OPT_REPORT},
+        {"cpu", required_argument, nullptr, OPT_CPU},
+        {"rt-prio", required_argument, nullptr, OPT_RT_PRIO},
+        {"nice", required_argument, nullptr, OPT_NICE},
+        {"mlock", no_argument, nullptr, OPT_MLOCK},
+        {"jitter", no_argument, nullptr, OPT_JITTER},
+        {"audit", required_argument, nullptr, OPT_AUDIT},
+        {"stale-after", required_argument, nullptr, OPT_STALE_AFTER},
+        {"histogram", optional_argument, nullptr, OPT_HISTOGRAM},
+        {"snapshot", required_argument, nullptr, OPT_SNAPSHOT},
+        {"diff", required_argument, nullptr, OPT_DIFF},
+        {"tolerance", required_argument, nullptr, OPT_TOLERANCE},
+        {"inventory", no_argument, nullptr, OPT_INVENTORY},
+        {"repl", no_argument, nullptr, OPT_REPL},
+        {"batch", no_argument, nullptr, OPT_BATCH},
+        {"discovery", required_argument, nullptr, OPT_DISCOVERY},
+        {"services", required_argument, nullptr, OPT_SERVICES},
+        {"summary", optional_argument, nullptr, OPT_SUMMARY},
+        {"events", no_argument, nullptr, OPT_EVENTS},
+        {"debounce", required_argument, nullptr, OPT_DEBOUNCE},
+        {"dwell", required_argument, nullptr, OPT_DWELL},
+        {"anomaly", required_argument, nullptr, OPT_ANOMALY},
+        {"anomaly-window", required_argument, nullptr, OPT_ANOMALY_WINDOW},
+        {"predict", required_argument, nullptr, OPT_PREDICT},
+        {"hwmon", optional_argument, nullptr, OPT_HWMON},
+        {"no-cache", no_argument, nullptr, OPT_NO_CACHE},
+        {"hwmon-root", required_argument, nullptr, OPT_HWMON_ROOT},
+        {"horizon", required_argument, nullptr, OPT_HORIZON},
         {"help", no_argument, nullptr, 'h'},
         // --- end of array ---
         {nullptr, 0, nullptr, '\0'}};
 
     int c;
 #ifdef WITH_REMOTE_HOST
-    while ((c = getopt_long(argc, argv, "H:cCw:n:h", opts, nullptr)) != -1)
+    while ((c = getopt_long(argc, argv, "H:AcCw:n:h", opts, nullptr)) != -1)
 #else
     while ((c = getopt_long(argc, argv, "cCw:n:h", opts, nullptr)) != -1)
 #endif
@@ -547,59 +3825,373 @@ int main(int argc, char* argv[])
             case 'H':
                 if (optarg)
                 {
-                    host = optarg;
+                    host = optarg;
+                }
+                else
+                {
+                    fprintf(stderr, "Remote host required with this option!\n");
+                    showhelp = true;
+                }
+                break;
+            case 'A':
+                use_agent = true;
+                break;
+#endif
+            case 'c':
+                cli_mode = true;
+                break;
+            case 'C':
+                // ignore "color" flag if output redirected
+                if (isatty(STDOUT_FILENO))
+                {
+                    useColors = true;
+                }
+                break;
+            case 'w': {
+                watch_mode = true;
+                std::string line(optarg);
+                size_t start;
+                size_t end = 0;
+                const char delim = ',';
+                while ((start = line.find_first_not_of(delim, end)) !=
+                       std::string::npos)
+                {
+                    end = line.find(delim, start);
+                    watch_list.emplace_back(line.substr(start, end - start));
+                }
+                break;
+            }
+            case 'n': {
+                char* end = nullptr;
+                watch.interval = strtod(optarg, &end);
+                if (end == optarg || *end)
+                {
+                    fprintf(stderr,
+                            "Can't read interval '%s', should be number of "
+                            "seconds!\n",
+                            optarg);
+                    showhelp = true;
+                }
+                else if (!(watch.interval >= 0.001))
+                {
+                    fprintf(stderr, "Invalid interval value: %s!\n", optarg);
+                    showhelp = true;
+                }
+                break;
+            }
+            case OPT_FORMAT:
+                if (!strcmp(optarg, "binary"))
+                {
+                    binaryOutput = true;
+                }
+                else if (!strcmp(optarg, "text"))
+                {
+                    binaryOutput = false;
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown output format '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_STDOUT_AGENT:
+                agentMode = true;
+                binaryOutput = true;
+                break;
+            case OPT_STATS:
+                if (!optarg || !strcmp(optarg, "bus"))
+                {
+                    showStats = true;
+                }
+                else if (!strcmp(optarg, "alloc"))
+                {
+#ifdef WITH_ALLOC_STATS
+                    showAllocStats = true;
+#else
+                    fprintf(stderr, "Built without the allocation counter, "
+                                    "see the alloc-stats option\n");
+                    showhelp = true;
+#endif
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown statistics '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_MAX_INFLIGHT:
+                if (!parseNumber(optarg, limits.maxInflight) ||
+                    !limits.maxInflight)
+                {
+                    fprintf(stderr, "Invalid requests limit '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_RATE:
+                if (!parseNumber(optarg, limits.rate))
+                {
+                    fprintf(stderr, "Invalid requests rate '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_TIMEOUT:
+                if (!parseNumber(optarg, limits.timeout))
+                {
+                    fprintf(stderr, "Invalid timeout '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_PRIORITY:
+                if (!priority.setCriteria(optarg))
+                {
+                    fprintf(stderr, "Invalid priority criteria '%s'!\n",
+                            optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_TAG: {
+                std::string line(optarg);
+                size_t start;
+                size_t end = 0;
+                const char delim = ',';
+                while ((start = line.find_first_not_of(delim, end)) !=
+                       std::string::npos)
+                {
+                    end = line.find(delim, start);
+                    priority.addTag(line.substr(start, end - start));
+                }
+                break;
+            }
+            case OPT_LOW_OVERHEAD:
+                watch.lowOverhead = true;
+                break;
+            case OPT_CPU_BUDGET: {
+                char* end = nullptr;
+                watch.cpuBudget = strtod(optarg, &end);
+                if (end == optarg || *end || !(watch.cpuBudget > 0) ||
+                    watch.cpuBudget > 100)
+                {
+                    fprintf(stderr, "Invalid CPU budget '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                watch.lowOverhead = true;
+                break;
+            }
+            case OPT_REPORT:
+                if (!parseNumber(optarg, watch.reportInterval))
+                {
+                    fprintf(stderr, "Invalid report interval '%s'!\n",
+                            optarg);
+                    showhelp = true;
+                }
+                report_set = true;
+                break;
+            case OPT_CPU: {
+                unsigned cpu = 0;
+                if (!parseNumber(optarg, cpu) || cpu >= CPU_SETSIZE)
+                {
+                    fprintf(stderr, "Invalid CPU number '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                else
+                {
+                    watch.cpu = static_cast<int>(cpu);
+                }
+                break;
+            }
+            case OPT_RT_PRIO:
+                if (!parseNumber(optarg, watch.rtPriority) ||
+                    !watch.rtPriority || watch.rtPriority > 99)
+                {
+                    fprintf(stderr, "Invalid real-time priority '%s'!\n",
+                            optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_NICE: {
+                char* end = nullptr;
+                const long nice = strtol(optarg, &end, 10);
+                if (end == optarg || *end || nice < -20 || nice > 19)
+                {
+                    fprintf(stderr, "Invalid nice value '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                watch.nice = static_cast<int>(nice);
+                break;
+            }
+            case OPT_MLOCK:
+                watch.mlock = true;
+                break;
+            case OPT_JITTER:
+                watch.jitter = true;
+                break;
+            case OPT_AUDIT:
+                if (!parseNumber(optarg, audit_window) || !audit_window)
+                {
+                    fprintf(stderr, "Invalid audit window '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_STALE_AFTER:
+                if (!parseNumber(optarg, stale_after) || !stale_after)
+                {
+                    fprintf(stderr, "Invalid stale period '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_HISTOGRAM:
+                watch.histogram = true;
+                if (!optarg || !strcmp(optarg, "table"))
+                {
+                    watch.histogramJson = false;
+                }
+                else if (!strcmp(optarg, "json"))
+                {
+                    watch.histogramJson = true;
                 }
                 else
                 {
-                    fprintf(stderr, "Remote host required with this option!\n");
+                    fprintf(stderr, "Unknown histogram format '%s'!\n",
+                            optarg);
                     showhelp = true;
                 }
                 break;
-#endif
-            case 'c':
-                cli_mode = true;
+            case OPT_INVENTORY:
+                showInventory = true;
                 break;
-            case 'C':
-                // ignore "color" flag if output redirected
-                if (isatty(STDOUT_FILENO))
+            case OPT_REPL:
+                repl_mode = true;
+                break;
+            case OPT_EVENTS:
+                events_mode = true;
+                break;
+            case OPT_DEBOUNCE:
+                if (!parseNumber(optarg, debounce.samples) ||
+                    !debounce.samples || debounce.samples > UINT16_MAX)
                 {
-                    useColors = true;
+                    fprintf(stderr, "Invalid debounce samples '%s'!\n",
+                            optarg);
+                    showhelp = true;
                 }
                 break;
-            case 'w': {
-                watch_mode = true;
-                std::string line(optarg);
-                size_t start;
-                size_t end = 0;
-                const char delim = ',';
-                while ((start = line.find_first_not_of(delim, end)) !=
-                       std::string::npos)
+            case OPT_DWELL: {
+                char* end = nullptr;
+                const double dwell = strtod(optarg, &end);
+                if (end == optarg || *end || !(dwell >= 0))
                 {
-                    end = line.find(delim, start);
-                    watch_list.emplace_back(line.substr(start, end - start));
+                    fprintf(stderr, "Invalid dwell time '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                else
+                {
+                    debounce.dwell = static_cast<uint64_t>(dwell * 1e6);
                 }
                 break;
             }
-            case 'n':
-                try
+            case OPT_ANOMALY: {
+                char* end = nullptr;
+                anomalyThreshold = strtod(optarg, &end);
+                if (end == optarg || *end || !(anomalyThreshold > 0))
                 {
-                    watch_interval = std::stoi(optarg);
+                    fprintf(stderr, "Invalid z-score '%s'!\n", optarg);
+                    showhelp = true;
                 }
-                catch (...)
+                break;
+            }
+            case OPT_ANOMALY_WINDOW:
+                if (!parseNumber(optarg, anomalyWindow) || !anomalyWindow)
                 {
-                    fprintf(stderr,
-                            "Can't read interval '%s', should be number of "
-                            "seconds!\n",
+                    fprintf(stderr, "Invalid anomaly window '%s'!\n",
+                            optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_HWMON:
+                watch.hwmon = true;
+                watch.hwmonMap = optarg;
+                break;
+            case OPT_NO_CACHE:
+                useCache = false;
+                break;
+            case OPT_HWMON_ROOT:
+                watch.hwmonRoot = optarg;
+                break;
+            case OPT_PREDICT:
+                if (!parseNumber(optarg, predictWindow) || predictWindow < 3)
+                {
+                    fprintf(stderr, "Invalid prediction window '%s'!\n",
+                            optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_HORIZON:
+                if (!parseNumber(optarg, predictHorizon) || !predictHorizon)
+                {
+                    fprintf(stderr, "Invalid prediction horizon '%s'!\n",
+                            optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_SUMMARY:
+                if (!optarg || !strcmp(optarg, "only"))
+                {
+                    showSummary = Summary::only;
+                }
+                else if (!strcmp(optarg, "footer"))
+                {
+                    showSummary = Summary::footer;
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown summary mode '%s'!\n", optarg);
+                    showhelp = true;
+                }
+                break;
+            case OPT_BATCH:
+                batch_mode = true;
+                break;
+            case OPT_DISCOVERY:
+                if (!strcmp(optarg, "mapper"))
+                {
+                    discovery = Discovery::mapper;
+                }
+                else if (!strcmp(optarg, "managed"))
+                {
+                    discovery = Discovery::managed;
+                }
+                else if (!strcmp(optarg, "auto"))
+                {
+                    discovery = Discovery::automatic;
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown discovery method '%s'!\n",
                             optarg);
                     showhelp = true;
                 }
-                if (watch_interval <= 0)
+                break;
+            case OPT_SERVICES:
+                services.clear();
+                splitList(optarg, services);
+                break;
+            case OPT_SNAPSHOT:
+                snapshot_file = optarg;
+                break;
+            case OPT_DIFF:
+                diff_file = optarg;
+                break;
+            case OPT_TOLERANCE: {
+                char* end = nullptr;
+                tolerance.value = strtod(optarg, &end);
+                tolerance.relative = (*end == '%');
+                if (end == optarg || *(end + tolerance.relative) ||
+                    !(tolerance.value >= 0))
                 {
-                    fprintf(stderr, "Invalid interval value: %d!\n",
-                            watch_interval);
+                    fprintf(stderr, "Invalid tolerance '%s'!\n", optarg);
                     showhelp = true;
                 }
                 break;
+            }
             case 'h':
                 showhelp = true;
                 break;
@@ -617,22 +4209,184 @@ int main(int argc, char* argv[])
         showhelp = true;
     }
 
+#ifdef WITH_REMOTE_HOST
+    if (use_agent && !host)
+    {
+        fprintf(stderr, "The agent requires a remote host!\n");
+        showhelp = true;
+    }
+#endif
+
     if (showhelp)
     {
         return usage(argv[0], cli_mode);
     }
+    if (events_mode && binaryOutput)
+    {
+        fprintf(stderr, "The events are printed as text only!\n");
+        return EXIT_FAILURE;
+    }
+
+    if (diff_file)
+    {
+        if (optind >= argc)
+        {
+            fprintf(stderr, "Second snapshot is required to compare!\n");
+            usage(argv[0], cli_mode);
+            // The diff exit status of errors
+            return 2;
+        }
+        return diffSnapshots(diff_file, argv[optind], tolerance);
+    }
+
+    if (watch.lowOverhead && !report_set)
+    {
+        watch.reportInterval = 600;
+    }
+    if (watch.jitter && !report_set && !watch.reportInterval)
+    {
+        watch.reportInterval = 60;
+    }
 
 #ifdef WITH_REMOTE_HOST
+    if (host && use_agent && audit_window)
+    {
+        fprintf(stderr, "The audit is not supported with the agent!\n");
+        return EXIT_FAILURE;
+    }
+    if (host && use_agent && events_mode)
+    {
+        fprintf(stderr, "The events are not supported with the agent!\n");
+        return EXIT_FAILURE;
+    }
+    if (host && use_agent && (repl_mode || batch_mode))
+    {
+        fprintf(stderr, "This mode is not supported with the agent!\n");
+        return EXIT_FAILURE;
+    }
+    if (host && use_agent && watch.histogram)
+    {
+        // The agent prints the histograms on its exit, but it is killed
+        // with the ssh session when the watch is interrupted
+        fprintf(stderr, "The histograms are not supported with the agent!\n");
+        return EXIT_FAILURE;
+    }
+    if (host && use_agent)
+    {
+        std::vector<std::string> args;
+        if (watch_mode)
+        {
+            std::string list;
+            for (const auto& name : watch_list)
+            {
+                list += (list.empty() ? "" : ",") + name;
+            }
+            args.emplace_back("--watch=" + list);
+            char interval[32];
+            snprintf(interval, sizeof(interval), "--interval=%g",
+                     watch.interval);
+            args.emplace_back(interval);
+            if (watch.lowOverhead)
+            {
+                args.emplace_back("--low-overhead");
+            }
+            if (watch.cpuBudget > 0)
+            {
+                args.emplace_back("--cpu-budget=" +
+                                  std::to_string(watch.cpuBudget));
+            }
+            args.emplace_back("--report=" +
+                              std::to_string(watch.reportInterval));
+            if (watch.cpu >= 0)
+            {
+                args.emplace_back("--cpu=" + std::to_string(watch.cpu));
+            }
+            if (watch.rtPriority)
+            {
+                args.emplace_back("--rt-prio=" +
+                                  std::to_string(watch.rtPriority));
+            }
+            if (watch.nice)
+            {
+                args.emplace_back("--nice=" + std::to_string(*watch.nice));
+            }
+            if (watch.mlock)
+            {
+                args.emplace_back("--mlock");
+            }
+            if (watch.jitter)
+            {
+                args.emplace_back("--jitter");
+            }
+            if (watch.hwmon)
+            {
+                // The map file is the agent host one
+                args.emplace_back(watch.hwmonMap ? std::string("--hwmon=") +
+                                                       watch.hwmonMap
+                                                 : "--hwmon");
+            }
+            if (strcmp(watch.hwmonRoot, HWMON_ROOT))
+            {
+                args.emplace_back(std::string("--hwmon-root=") +
+                                  watch.hwmonRoot);
+            }
+        }
+        if (showInventory)
+        {
+            args.emplace_back("--inventory");
+        }
+        if (!useCache)
+        {
+            args.emplace_back("--no-cache");
+        }
+        if (discovery == Discovery::mapper)
+        {
+            args.emplace_back("--discovery=mapper");
+        }
+        else if (discovery == Discovery::managed)
+        {
+            args.emplace_back("--discovery=managed");
+        }
+        std::vector<std::string> default_services;
+        splitList(DISCOVERY_SERVICES, default_services);
+        if (services != default_services)
+        {
+            std::string list;
+            for (const auto& name : services)
+            {
+                list += (list.empty() ? "" : ",") + name;
+            }
+            args.emplace_back("--services=" + list);
+        }
+        if (optind < argc)
+        {
+            args.emplace_back(argv[optind]);
+        }
+        return runRemoteAgent(host, REMOTE_AGENT_COMMAND, args, watch_mode);
+    }
     if (host)
     {
         printf("Open DBus session to %s\n", host);
-        sd_bus* b = nullptr;
-        sd_bus_open_system_remote(&b, host);
-        systemBus = sdbusplus::bus::bus(b, std::false_type());
+        connectBus(host);
+        cacheHost = host;
     }
 #endif
 
-    std::string root_path = SENSORS_PATH;
+    if (repl_mode)
+    {
+        Fetcher fetcher(limits, priority);
+        return Repl(fetcher).run();
+    }
+
+    const bool listing =
+        !audit_window && !watch_mode && !batch_mode && !events_mode;
+    // The listing snapshot goes to the file with its own header
+    if (binaryOutput && !(listing && snapshot_file))
+    {
+        BinaryWriter(stdout).header();
+    }
+
+    std::string type;
     if (optind < argc)
     {
         const size_t len = strlen(argv[optind]);
@@ -646,47 +4400,293 @@ int main(int argc, char* argv[])
             }
         }
 
-        root_path += "/";
-        root_path += argv[optind];
+        type = argv[optind];
     }
+    const std::string root_path = sensorsPath(type);
 
-    auto method = systemBus.new_method_call(MAPPER_SERVICE, MAPPER_PATH,
-                                            MAPPER_IFACE, "GetSubTree");
-    const std::vector<std::string> ifaces = {SENSOR_VALUE_IFACE};
-    method.append(root_path, 0, ifaces);
-
-
-    Objects objects;
-    try
+    AllocPhase alloc;
+    Fetcher fetcher(limits, priority);
+    Topology topology;
+    // Sensors with values, if discovered without the mapper
+    std::optional<Samples> discovered;
+    // Sensors fetched during the discovery and the mask of the fetched ones
+    std::optional<Samples> prefetched;
+    std::vector<bool> prefetched_mask;
+    // The layout of the listed sensors is remembered to fetch them
+    // speculatively next time
+    std::string cached_topology;
+    // Sensors seen unavailable by the previous runs, the entries are kept
+    // in the real time
+    std::optional<NegativeCache> negative;
+    std::vector<bool> negative_mask;
+    std::string cached_negative;
+    // Static properties of the sensors fetched by the previous runs
+    std::optional<MetadataCache> metadata;
+    std::string cached_metadata;
+    const uint64_t now = time(nullptr) * 1000000ull;
+    if (discovery != Discovery::managed)
     {
-        systemBus.call(method).read(objects);
+        if (listing && useCache)
+        {
+            cached_topology = readCache(topologyCache(type));
+            cached_negative = readCache(cacheFile(NEGATIVE_CACHE));
+            negative.emplace(LISTING_NEGATIVE_MIN_DELAY,
+                             LISTING_NEGATIVE_MAX_DELAY);
+            negative->load(cached_negative);
+            cached_metadata = readCache(cacheFile(METADATA_CACHE));
+            metadata.emplace(METADATA_TTL);
+            metadata->load(cached_metadata, now);
+        }
+        try
+        {
+            const uint64_t timeout =
+                discovery == Discovery::automatic ? MAPPER_TIMEOUT : 0;
+            if (cached_topology.empty())
+            {
+                discover(root_path, topology, timeout);
+            }
+            else
+            {
+                Samples expected = parseTopology(cached_topology);
+                if (!negative->empty())
+                {
+                    std::vector<bool> mask(expected.size(), false);
+                    negative->skip(expected, now, mask);
+                    size_t kept = 0;
+                    for (size_t i = 0; i < expected.size(); ++i)
+                    {
+                        if (!mask[i])
+                        {
+                            expected[kept++] = std::move(expected[i]);
+                        }
+                    }
+                    expected.resize(kept);
+                }
+                std::vector<Interfaces> dynamic;
+                metadata->select(expected, dynamic);
+                prefetched = discoverPrefetch(
+                    root_path, topology, std::move(expected), fetcher,
+                    prefetched_mask, timeout, dynamic);
+            }
+            if (listing && useCache)
+            {
+                std::string layout = formatTopology(topology);
+                if (layout != cached_topology)
+                {
+                    writeCache(topologyCache(type), layout);
+                }
+            }
+        }
+        catch (const sdbusplus::exception::SdBusError& ex)
+        {
+            if (!strcmp(ex.name(), "org.freedesktop.DBus.Error.FileNotFound"))
+            {
+                fprintf(stderr, "No sensors of selected type are present\n");
+                return usage(argv[0], cli_mode);
+            }
+            fprintf(stderr, "Error: %s\n", ex.what());
+            if (discovery == Discovery::mapper || isConnectionLost(ex))
+            {
+                return EXIT_FAILURE;
+            }
+            fprintf(stderr, "Mapper is not available, asking the services\n");
+            discovery = Discovery::managed;
+        }
     }
-    catch (const sdbusplus::exception::SdBusError& ex)
+    if (discovery == Discovery::managed)
     {
-        if (!strcmp(ex.name(), "org.freedesktop.DBus.Error.FileNotFound"))
+        try
+        {
+            discovered.emplace();
+            const size_t failures =
+                discoverManaged(root_path, services, topology, *discovered,
+                                limits.timeout * 1000ull);
+            if (failures)
+            {
+                fprintf(stderr, "%zu services failed to list objects\n",
+                        failures);
+            }
+        }
+        catch (const sdbusplus::exception::SdBusError& ex)
+        {
+            fprintf(stderr, "Error: %s\n", ex.what());
+            return EXIT_FAILURE;
+        }
+        if (topology.objects.empty())
         {
             fprintf(stderr, "No sensors of selected type are present\n");
             return usage(argv[0], cli_mode);
         }
-        else
+    }
+
+    if (showInventory)
+    {
+        if (!resolveInventory(topology))
+        {
+            fprintf(stderr, "Failed to get the inventory associations\n");
+        }
+    }
+    alloc.report("discovery");
+
+    if (audit_window)
+    {
+        return auditSensors(topology.objects, root_path, audit_window,
+                            stale_after ? stale_after : audit_window, fetcher);
+    }
+    if (events_mode)
+    {
+        return watchEvents(watch_list, watch, debounce, topology, fetcher);
+    }
+    if (watch_mode)
+    {
+        return watch_senors(watch_list, watch, topology, fetcher);
+    }
+    if (batch_mode)
+    {
+        return batchQueries(topology, fetcher);
+    }
+
+    Samples samples;
+    if (discovered || prefetched)
+    {
+        // The values came with the discovery, all or some of them
+        samples = std::move(discovered ? *discovered : *prefetched);
+        for (auto& sample : samples)
+        {
+            auto item = topology.inventory.find(sample.path);
+            if (item != topology.inventory.end())
+            {
+                sample.inventory = item->second;
+            }
+        }
+    }
+    else
+    {
+        samples = makeSamples(topology);
+    }
+    if (!discovered)
+    {
+        // Only the sensors missing from the previous run layout and not
+        // known to be unavailable
+        std::vector<bool> skip = prefetched_mask;
+        skip.resize(samples.size(), false);
+        if (negative)
+        {
+            negative_mask.assign(samples.size(), false);
+            negative->skip(samples, now, negative_mask);
+            for (size_t i = 0; i < samples.size(); ++i)
+            {
+                skip[i] = skip[i] || negative_mask[i];
+            }
+        }
+        // The sensors with the cached static properties are asked for the
+        // dynamic ones only, the same ones as during the discovery
+        std::vector<Interfaces> dynamic;
+        if (metadata)
+        {
+            metadata->select(samples, dynamic);
+        }
+        try
+        {
+            fetcher.fetch(samples, skip, dynamic);
+        }
+        catch (const sdbusplus::exception::SdBusError& ex)
         {
             fprintf(stderr, "Error: %s\n", ex.what());
             return EXIT_FAILURE;
         }
+        if (metadata)
+        {
+            metadata->apply(samples, dynamic);
+            // The prefetched sensors are fetched too, just earlier
+            metadata->store(samples, fetcher, negative_mask, dynamic, now);
+            const std::string data = metadata->save();
+            if (data != cached_metadata)
+            {
+                writeCache(cacheFile(METADATA_CACHE), data);
+            }
+        }
+        if (negative)
+        {
+            negative->update(samples, fetcher, negative_mask, now);
+            if (!negative->empty() || !cached_negative.empty())
+            {
+                const std::string data = negative->save();
+                if (data != cached_negative)
+                {
+                    writeCache(cacheFile(NEGATIVE_CACHE), data);
+                }
+            }
+        }
+        alloc.report("fetch");
+
+        // Drop the sensors failed to fetch
+        size_t fetched = 0;
+        size_t timedOut = 0;
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            if (fetcher.timedOut(i))
+            {
+                ++timedOut;
+            }
+            else if (fetcher.failed(i))
+            {
+                fprintf(stderr, "Get properties for %s failed\n",
+                        samples[i].path.c_str());
+            }
+            else
+            {
+                if (fetched != i)
+                {
+                    samples[fetched] = std::move(samples[i]);
+                }
+                ++fetched;
+            }
+        }
+        samples.resize(fetched);
+        if (timedOut)
+        {
+            fprintf(stderr, "%zu sensors were not fetched in time\n",
+                    timedOut);
+        }
+
+        if (showStats)
+        {
+            fetcher.printStats(stderr);
+        }
     }
 
-    if (watch_mode)
+    if (!binaryOutput && !snapshot_file)
     {
-        return watch_senors(watch_list, watch_interval, objects);
+        printListing(samples);
+        alloc.report("format");
     }
 
-    for (const auto& obj : objects)
+    if (snapshot_file)
     {
-        for (const auto& service : obj.second)
+        FILE* out = fopen(snapshot_file, "wb");
+        if (!out)
+        {
+            fprintf(stderr, "Can't create %s: %s\n", snapshot_file,
+                    strerror(errno));
+            return EXIT_FAILURE;
+        }
+        BinaryWriter writer(out);
+        writer.header();
+        writer.snapshot(time(nullptr), samples);
+        if (fclose(out) != 0)
         {
-            printSensorData(service.first, obj.first);
+            fprintf(stderr, "Can't write %s: %s\n", snapshot_file,
+                    strerror(errno));
+            return EXIT_FAILURE;
         }
     }
+    else if (binaryOutput)
+    {
+        BinaryWriter writer(stdout);
+        writer.snapshot(time(nullptr), samples);
+        fflush(stdout);
+    }
 
     return EXIT_SUCCESS;
 }
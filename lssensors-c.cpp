@@ -0,0 +1,169 @@
+#include "lssensors.h"
+
+#include "lssensors.hpp"
+
+#include <cerrno>
+#include <cmath>
+
+using namespace lssensors;
+
+struct lssensors_set
+{
+    Samples samples;
+    // Units of the samples, trimmed of the alignment spaces
+    std::vector<std::string> units;
+    std::unique_ptr<Fetcher> fetcher;
+
+    /**
+     * @brief Refresh the cached data after the samples update
+     */
+    void updated()
+    {
+        units.resize(samples.size());
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            units[i] = samples[i].props.unit();
+            units[i].erase(units[i].find_last_not_of(' ') + 1);
+        }
+    }
+};
+
+/**
+ * @brief Map the exception to the negative errno
+ */
+static int errorCode()
+{
+    try
+    {
+        throw;
+    }
+    catch (const sdbusplus::exception::SdBusError& ex)
+    {
+        return -ex.get_errno();
+    }
+    catch (const std::bad_alloc&)
+    {
+        return -ENOMEM;
+    }
+    catch (...)
+    {
+        return -EIO;
+    }
+}
+
+void lssensors_use_bus(struct sd_bus* bus)
+{
+    useBus(bus);
+}
+
+lssensors_t* lssensors_open(const char* type)
+{
+    try
+    {
+        Topology topology;
+        discover(sensorsPath(type ? type : ""), topology);
+
+        auto sensors = std::make_unique<lssensors_set>();
+        sensors->samples = makeSamples(topology);
+        sensors->fetcher = std::make_unique<Fetcher>(FetchPriority());
+        sensors->updated();
+        return sensors.release();
+    }
+    catch (...)
+    {
+        errno = -errorCode();
+        return nullptr;
+    }
+}
+
+void lssensors_close(lssensors_t* sensors)
+{
+    delete sensors;
+}
+
+int lssensors_update(lssensors_t* sensors)
+{
+    try
+    {
+        sensors->fetcher->fetch(sensors->samples);
+        sensors->updated();
+        return 0;
+    }
+    catch (...)
+    {
+        return errorCode();
+    }
+}
+
+size_t lssensors_count(const lssensors_t* sensors)
+{
+    return sensors->samples.size();
+}
+
+int lssensors_get(const lssensors_t* sensors, size_t index,
+                  struct lssensors_reading* reading)
+{
+    if (index >= sensors->samples.size())
+    {
+        return -EINVAL;
+    }
+
+    const Sample& sample = sensors->samples[index];
+    const Properties& props = sample.props;
+    reading->path = sample.path.c_str();
+    reading->name = reading->path + sample.path.rfind('/') + 1;
+    reading->unit = sensors->units[index].c_str();
+    reading->value = props.reading().value_or(NAN);
+    reading->critical_low = props.number("CriticalLow").value_or(NAN);
+    reading->warning_low = props.number("WarningLow").value_or(NAN);
+    reading->warning_high = props.number("WarningHigh").value_or(NAN);
+    reading->critical_high = props.number("CriticalHigh").value_or(NAN);
+
+    switch (props.empty() ? Status::unavailable : props.state())
+    {
+        case Status::ok:
+            reading->status = LSSENSORS_OK;
+            break;
+        case Status::warning:
+            reading->status = LSSENSORS_WARNING;
+            break;
+        case Status::critical:
+            reading->status = LSSENSORS_CRITICAL;
+            break;
+        case Status::fatal:
+            reading->status = LSSENSORS_FATAL;
+            break;
+        case Status::failed:
+            reading->status = LSSENSORS_FAILED;
+            break;
+        case Status::unavailable:
+            reading->status = LSSENSORS_UNAVAILABLE;
+            break;
+    }
+    return 0;
+}
+
+int lssensors_watch(lssensors_t* sensors, double interval,
+                    lssensors_callback callback, lssensors_cancel cancel,
+                    void* data)
+{
+    if (interval <= 0)
+    {
+        return -EINVAL;
+    }
+    try
+    {
+        const bool watched = watch(
+            sensors->samples, *sensors->fetcher, interval,
+            [&](const Samples&) {
+                sensors->updated();
+                return callback(sensors, data) == 0;
+            },
+            [&] { return cancel && cancel(data) != 0; });
+        return watched ? 0 : -ECANCELED;
+    }
+    catch (...)
+    {
+        return errorCode();
+    }
+}
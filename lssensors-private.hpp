@@ -0,0 +1,484 @@
+/**
+ * @brief Internals of the sensors library shared with the lssensors front
+ *        end: caches, hwmon reader and the values evaluation.
+ *
+ * The header is not installed, its declarations may change at any time.
+ */
+
+#pragma once
+
+#include "lssensors.hpp"
+
+#include <sdbusplus/bus/match.hpp>
+#include <unordered_map>
+
+namespace lssensors
+{
+
+// Property of the sensors shown unavailable by NegativeCache without asking
+static constexpr auto CACHED_PROPERTY = "Cached";
+
+/**
+ * @brief Fetcher limiter settings
+ */
+struct Fetcher::Limits
+{
+    // Upper bound of outstanding requests per service
+    unsigned maxInflight = 16;
+    // Global requests rate, per second (0 - unlimited)
+    unsigned rate = 1000;
+    // Token bucket depth
+    unsigned burst = 64;
+    // Sweep timeout, milliseconds (0 - unlimited)
+    unsigned timeout = 0;
+};
+
+/**
+ * @brief Cache of the sensors recently seen unavailable.
+ *
+ * The sensors that were not available, failed to answer or timed out are
+ * not asked again until their backoff delay expires; the delay doubles on
+ * every repeated failure. Meanwhile they are shown as N/A, with the
+ * CACHED_PROPERTY set. The entries are dropped on the availability changes
+ * and on the host state change.
+ */
+class NegativeCache
+{
+  public:
+    /**
+     * @brief Constructor
+     *
+     * @param minDelay - First backoff delay, us
+     * @param maxDelay - Backoff delay limit, us
+     */
+    NegativeCache(uint64_t minDelay, uint64_t maxDelay);
+
+    NegativeCache(const NegativeCache&) = delete;
+    NegativeCache& operator=(const NegativeCache&) = delete;
+
+    /**
+     * @brief Mark the sensors not to ask now
+     *
+     * @param samples - Sensors to fetch
+     * @param now     - Current time, us, in the same clock for all calls
+     * @param mask    - Mask to set the skipped sensors in, by index, the
+     *                  other sensors are left as is
+     */
+    void skip(const Samples& samples, uint64_t now,
+              std::vector<bool>& mask) const;
+
+    /**
+     * @brief Account the sweep results
+     *
+     * The skipped sensors get the N/A properties.
+     *
+     * @param samples - Fetched sensors
+     * @param fetcher - Fetcher of the sweep
+     * @param mask    - Sensors skipped by this cache, as set by skip()
+     * @param now     - Current time, us
+     */
+    void update(Samples& samples, const Fetcher& fetcher,
+                const std::vector<bool>& mask, uint64_t now);
+
+    /**
+     * @brief Check if there are no entries
+     */
+    bool empty() const
+    {
+        return entries.empty();
+    }
+
+    /**
+     * @brief Drop the entries on the availability and host state changes
+     *
+     * @param root_path - Sensors root path
+     */
+    void subscribe(const std::string& root_path);
+
+    /**
+     * @brief Serialize the cache, along with the host state
+     */
+    std::string save() const;
+
+    /**
+     * @brief Load the serialized cache, unless the host state has changed
+     */
+    void load(const std::string& data);
+
+  private:
+    struct Entry
+    {
+        // Time to ask the sensor again, us
+        uint64_t retry;
+        // Current backoff delay, us
+        uint64_t delay;
+    };
+
+    uint64_t minDelay;
+    uint64_t maxDelay;
+    // Entries by the sensor path
+    std::unordered_map<std::string, Entry> entries;
+    std::vector<std::unique_ptr<sdbusplus::bus::match::match>> matches;
+};
+
+/**
+ * @brief Cache of the static sensors properties: scale, associations, etc.
+ *
+ * The sensors with all the dynamic properties (value, availability,
+ * operational status and alarms) on one interface, typically the bare
+ * Sensor.Value ones, are asked for that interface only, the rest is taken
+ * from the cache. The others are not cached: the properties of several
+ * interfaces cost as much as all of them in a single call. The thresholds
+ * come along with the alarms, so their changes are seen at once. The
+ * entries are bound to the unique name of the service owner, so they are
+ * dropped when the service restarts, and expire after the TTL.
+ */
+class MetadataCache
+{
+  public:
+    /**
+     * @brief Constructor
+     *
+     * @param ttl - Entry lifetime, us
+     */
+    explicit MetadataCache(uint64_t ttl);
+
+    /**
+     * @brief Select the sensors to get the dynamic properties only of
+     *
+     * The entries of the restarted services are dropped first.
+     *
+     * @param samples - Sensors to fetch
+     * @param dynamic - Interfaces of the dynamic properties to set, by index
+     */
+    void select(const Samples& samples, std::vector<Interfaces>& dynamic);
+
+    /**
+     * @brief Add the cached properties to the sensors fetched partially
+     *
+     * @param samples - Fetched sensors
+     * @param dynamic - Interfaces set by select()
+     */
+    void apply(Samples& samples, const std::vector<Interfaces>& dynamic) const;
+
+    /**
+     * @brief Remember the properties of the fully fetched sensors
+     *
+     * @param samples - Fetched sensors
+     * @param fetcher - Fetcher of the sweep
+     * @param skip    - Sensors not fetched, by index
+     * @param dynamic - Interfaces set by select()
+     * @param now     - Current time, us
+     */
+    void store(const Samples& samples, const Fetcher& fetcher,
+               const std::vector<bool>& skip,
+               const std::vector<Interfaces>& dynamic, uint64_t now);
+
+    /**
+     * @brief Serialize the cache
+     */
+    std::string save() const;
+
+    /**
+     * @brief Load the serialized cache, dropping the expired entries
+     *
+     * @param data - Serialized cache
+     * @param now  - Current time, us
+     */
+    void load(const std::string& data, uint64_t now);
+
+  private:
+    using Value = std::variant<int64_t, double, bool, std::string>;
+
+    struct Entry
+    {
+        Service service;
+        // Unique name of the service owner
+        std::string owner;
+        // Time the properties were fetched, us
+        uint64_t stored;
+        // Interfaces the dynamic properties are got from
+        Interfaces ifaces;
+        std::vector<std::pair<std::string, Value>> props;
+    };
+
+    /**
+     * @brief Resolve the owners of the sensors services not known yet
+     */
+    void resolve(const Samples& samples);
+
+    /**
+     * @brief Get the unique name of the service owner, empty if none
+     */
+    const std::string& owner(const Service& service) const;
+
+    uint64_t ttl;
+    // Entries by the sensor path
+    std::unordered_map<Path, Entry> entries;
+    // Resolved owners of the services
+    std::map<Service, std::string> owners;
+};
+
+/**
+ * @brief Reader of the sensors values directly from hwmon sysfs.
+ *
+ * Bypasses the sensor daemons for the sensors backed by the local hwmon
+ * attributes. The attributes are opened once and re-read with pread on
+ * every update; only the Value property is replaced, the rest of the
+ * properties come from the bus.
+ */
+class HwmonReader
+{
+  public:
+    /**
+     * @brief Constructor
+     *
+     * @param root - Hwmon class directory, like /sys/class/hwmon
+     */
+    explicit HwmonReader(const std::string& root);
+    ~HwmonReader();
+
+    HwmonReader(const HwmonReader&) = delete;
+    HwmonReader& operator=(const HwmonReader&) = delete;
+
+    /**
+     * @brief Map the sensors to the hwmon attributes
+     *
+     * The map file has a line per sensor: the sensor name or path and the
+     * attribute path, relative to the root. Without the map file the
+     * sensors are matched with the attributes labels of the same type.
+     *
+     * @param samples - Sensors, already fetched from the bus
+     * @param config  - Map file, nullptr to match by labels
+     *
+     * @return number of the mapped sensors
+     *
+     * @throw std::runtime_error if the map file can't be read
+     */
+    size_t map(const Samples& samples, const char* config);
+
+    /**
+     * @brief Get the mask of the mapped sensors, by index
+     */
+    const std::vector<bool>& mapped() const
+    {
+        return mask;
+    }
+
+    /**
+     * @brief Read the values of the mapped sensors
+     *
+     * The threshold alarms are set from the read values, as the bus ones
+     * are refreshed rarely.
+     *
+     * @param samples - The same sensors as mapped
+     */
+    void read(Samples& samples);
+
+  private:
+    struct Attribute
+    {
+        size_t index;
+        int fd;
+        // Multiplier from the attribute units to the Value units
+        double factor;
+        // The sensor publishes the scaled integer Value
+        bool integer;
+    };
+
+    std::string root;
+    std::vector<Attribute> attributes;
+    std::vector<bool> mask;
+};
+
+/**
+ * @brief Debounced tracker of the sensors states.
+ *
+ * A new state is accepted only after it has been seen in the number of
+ * consecutive samples and has lasted for the dwell time, so a flapping
+ * sensor does not produce a transition on every sample.
+ */
+class StatusTracker
+{
+  public:
+    /**
+     * @brief Conditions to accept the new state
+     */
+    struct Debounce
+    {
+        // Number of consecutive samples with the new state
+        unsigned samples = 1;
+        // Minimal time the new state lasts, us
+        uint64_t dwell = 0;
+    };
+
+    /**
+     * @brief Constructor
+     *
+     * @param count    - Number of the tracked sensors
+     * @param debounce - Conditions to accept the new state
+     */
+    StatusTracker(size_t count, const Debounce& debounce);
+
+    /**
+     * @brief Account the sensor state
+     *
+     * The first state of the sensor is accepted as is.
+     *
+     * @param index - Sensor index
+     * @param state - Current sensor state
+     * @param now   - Monotonic time of the sample, us
+     *
+     * @return previous state if the sensor has changed its state
+     */
+    std::optional<Status> update(size_t index, Status state, uint64_t now);
+
+    /**
+     * @brief Get the last accepted state of the sensor
+     */
+    Status state(size_t index) const
+    {
+        return static_cast<Status>(states[index].stable);
+    }
+
+  private:
+    struct State
+    {
+        // Last accepted state
+        uint8_t stable;
+        // State waiting to be accepted
+        uint8_t pending;
+        // Number of consecutive samples with the pending state
+        uint16_t seen;
+        // Time the pending state was first seen, us
+        uint64_t since;
+    };
+
+    // No state is accepted yet
+    static constexpr uint8_t UNKNOWN = 0xff;
+
+    Debounce debounce;
+    std::vector<State> states;
+};
+
+/**
+ * @brief Detector of the values deviating from the recent sensor behavior.
+ *
+ * Keeps the exponentially weighted mean and variance per sensor and scores
+ * each new value against them before accounting it.
+ */
+class AnomalyDetector
+{
+  public:
+    /**
+     * @brief Constructor
+     *
+     * @param count     - Number of the tracked sensors
+     * @param threshold - Z-score to report the value as anomalous
+     * @param window    - Number of samples to average over, no values are
+     *                    reported until the sensor has that many samples
+     */
+    AnomalyDetector(size_t count, double threshold, unsigned window);
+
+    /**
+     * @brief Account the sensor value
+     *
+     * @param index - Sensor index
+     * @param value - Current sensor value
+     *
+     * @return z-score if the value is anomalous
+     */
+    std::optional<double> update(size_t index, double value);
+
+  private:
+    struct State
+    {
+        double mean;
+        double variance;
+        // Number of accounted values
+        uint32_t count;
+    };
+
+    // Weight of the new value
+    double alpha;
+    double threshold;
+    unsigned warmup;
+    std::vector<State> states;
+};
+
+/**
+ * @brief Predictor of the time the sensors reach their thresholds.
+ *
+ * Fits a line to the last values of each sensor. The regression sums are
+ * updated incrementally when a value enters or leaves the window, and are
+ * recomputed once per window to drop the accumulated rounding errors.
+ */
+class TrendPredictor
+{
+  public:
+    /**
+     * @brief Predicted threshold crossing
+     */
+    struct Prediction
+    {
+        // Time left, seconds
+        double eta;
+        // Threshold name, as in the table header
+        const char* threshold;
+        // Threshold value
+        double limit;
+    };
+
+    /**
+     * @brief Constructor
+     *
+     * @param count  - Number of the tracked sensors
+     * @param window - Number of the last values to fit the line to
+     */
+    TrendPredictor(size_t count, unsigned window);
+
+    /**
+     * @brief Account the sensor value
+     *
+     * @param index - Sensor index
+     * @param time  - Monotonic time of the value, seconds
+     * @param value - Sensor value
+     */
+    void update(size_t index, double time, double value);
+
+    /**
+     * @brief Predict the next threshold the sensor reaches
+     *
+     * @param index - Sensor index
+     * @param time  - Current monotonic time, seconds
+     * @param props - Sensor properties with the thresholds
+     *
+     * @return crossing of the nearest threshold in the trend direction
+     */
+    std::optional<Prediction> predict(size_t index, double time,
+                                      const Properties& props) const;
+
+  private:
+    struct State
+    {
+        // Position of the oldest value
+        unsigned head;
+        // Number of values in the window
+        unsigned size;
+        // Time the window times are relative to, seconds
+        double origin;
+        // Regression sums
+        double sx;
+        double sy;
+        double sxx;
+        double sxy;
+    };
+
+    unsigned window;
+    std::vector<State> states;
+    // Values windows of all sensors, one after another
+    std::vector<double> times;
+    std::vector<double> values;
+};
+
+} // namespace lssensors
@@ -0,0 +1,3040 @@
+#include "config.h"
+
+#include "lssensors-private.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+
+namespace lssensors
+{
+
+// Bus connection, the default one is opened on the first use
+static std::optional<sdbusplus::bus::bus> systemBus;
+// Remote host the bus is connected to, nullptr for the local bus
+static const char* remoteHost = nullptr;
+
+static constexpr auto ASSOCIATION_IFACE = "xyz.openbmc_project.Association";
+static constexpr auto AVAILABILITY_IFACE =
+    "xyz.openbmc_project.State.Decorator.Availability";
+static constexpr auto OPERATIONAL_IFACE =
+    "xyz.openbmc_project.State.Decorator.OperationalStatus";
+// Threshold interfaces are named by the kind, like Warning or HardShutdown
+static constexpr auto THRESHOLD_IFACE_PREFIX =
+    "xyz.openbmc_project.Sensor.Threshold.";
+static constexpr auto HOST_SERVICE = "xyz.openbmc_project.State.Host";
+static constexpr auto HOST_PATH = "/xyz/openbmc_project/state/host0";
+static constexpr auto HOST_IFACE = "xyz.openbmc_project.State.Host";
+
+sdbusplus::bus::bus& bus()
+{
+    if (!systemBus)
+    {
+        systemBus.emplace(sdbusplus::bus::new_default());
+    }
+    return *systemBus;
+}
+
+void useBus(sd_bus* conn)
+{
+    systemBus.emplace(conn);
+    remoteHost = nullptr;
+}
+
+const char* statusName(Status status)
+{
+    switch (status)
+    {
+        case Status::ok:
+            return "OK";
+        case Status::warning:
+            return "Warning";
+        case Status::critical:
+            return "Critical";
+        case Status::fatal:
+            return "Fatal";
+        case Status::failed:
+            return "FAIL";
+        case Status::unavailable:
+            break;
+    }
+    return "N/A";
+}
+
+void Properties::borrow(sd_bus_message* m)
+{
+    if (!reply || reply.get() != m)
+    {
+        reply.reset(sd_bus_message_ref(m), sd_bus_message_unref);
+    }
+}
+
+std::string_view Properties::keep(std::string&& str)
+{
+    if (!strings)
+    {
+        strings = std::make_shared<std::deque<std::string>>();
+    }
+    return strings->emplace_back(std::move(str));
+}
+
+std::string Properties::functional() const
+{
+    std::string ret = "OK";
+    auto it = this->find("Functional");
+    if (it != this->end() && std::get<bool>(it->second) == false)
+    {
+        ret = "FAIL";
+    }
+    it = this->find("Available");
+    if (it != this->end() && std::get<bool>(it->second) == false)
+    {
+        ret = "N/A";
+    }
+
+    return ret;
+}
+
+Status Properties::state() const
+{
+    const std::string ret = functional();
+    if ("N/A" == ret)
+    {
+        return Status::unavailable;
+    }
+    if ("FAIL" == ret)
+    {
+        return Status::failed;
+    }
+    if (getBool("FatalAlarmHigh"))
+    {
+        return Status::fatal;
+    }
+    if (getBool("CriticalAlarmLow") || getBool("CriticalAlarmHigh"))
+    {
+        return Status::critical;
+    }
+    if (getBool("WarningAlarmLow") || getBool("WarningAlarmHigh"))
+    {
+        return Status::warning;
+    }
+    return Status::ok;
+}
+
+std::string Properties::status() const
+{
+    return statusName(state());
+}
+
+float Properties::scale() const
+{
+    float ret = 1.f;
+    auto it = this->find("Scale");
+    if (it != this->end())
+    {
+        auto value = std::get<int64_t>(it->second);
+        ret = powf(10, static_cast<float>(value));
+    }
+    return ret;
+}
+
+std::string Properties::value() const
+{
+    if ("OK" != functional())
+    {
+        return "N/A";
+    }
+
+    return getValue("Value");
+}
+
+std::string Properties::criticalLow() const
+{
+    return getValue("CriticalLow");
+}
+
+std::string Properties::criticalHigh() const
+{
+    return getValue("CriticalHigh");
+}
+
+std::string Properties::warningLow() const
+{
+    return getValue("WarningLow");
+}
+
+std::string Properties::warningHigh() const
+{
+    return getValue("WarningHigh");
+}
+
+std::string Properties::fatalHigh() const
+{
+    return getValue("FatalHigh");
+}
+
+std::string Properties::unit() const
+{
+    std::string ret;
+
+    auto it = this->find("Unit");
+    if (it != this->end())
+    {
+        auto name = std::get<std::string_view>(it->second);
+        name = name.substr(name.rfind('.') + 1);
+
+        if ("Volts" == name)
+        {
+            ret = "V";
+        }
+        else if ("DegreesC" == name)
+        {
+            // The degrees character takes two bytes, but only one place
+            // on the screen. It breaks the alignment.
+            // Force fit the string to 3 screen characters long.
+            ret = "°C ";
+        }
+        else if ("Amperes" == name)
+        {
+            ret = "A";
+        }
+        else if ("RPMS" == name)
+        {
+            ret = "RPM";
+        }
+        else if ("Watts" == name)
+        {
+            ret = "W";
+        }
+        else if ("Joules" == name)
+        {
+            ret = "J";
+        }
+        else if ("Meters" == name)
+        {
+            ret = "m";
+        }
+        else if ("Percent" == name)
+        {
+            ret = "%";
+        }
+        else
+        {
+            ret = name;
+        }
+    }
+
+    return ret;
+}
+
+std::optional<double> Properties::number(const PropertyName& name) const
+{
+    auto it = this->find(name);
+    if (it != this->end())
+    {
+        if (auto value = std::get_if<double>(&it->second))
+        {
+            if (!std::isnan(*value))
+            {
+                return *value;
+            }
+        }
+        else if (auto value = std::get_if<int64_t>(&it->second))
+        {
+            return *value * scale();
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<double> Properties::reading() const
+{
+    if ("OK" != functional())
+    {
+        return std::nullopt;
+    }
+    return number("Value");
+}
+
+bool Properties::getBool(const PropertyName& name) const
+{
+    auto it = this->find(name);
+    return (it == this->end() ? false : std::get<bool>(it->second));
+}
+
+std::string Properties::getValue(const PropertyName& name) const
+{
+    std::string ret(8, '\0');
+    auto it = this->find(name);
+    if (it == this->end())
+    {
+        ret = "N/A";
+    }
+    else if (std::holds_alternative<double>(it->second))
+    {
+        auto value = std::get<double>(it->second);
+        if (std::isnan(value))
+        {
+            ret = "N/A";
+        }
+        else if (value < 1000)
+        {
+            const size_t len =
+                snprintf(ret.data(), ret.size(), "%7.03f", value);
+            ret.resize(len);
+        }
+        else
+        {
+            const size_t len =
+                snprintf(ret.data(), ret.size(), "%7d", (int)(value));
+            ret.resize(len);
+        }
+    }
+    else
+    {
+        auto factor = scale();
+        auto value = std::get<int64_t>(it->second);
+        if (factor < 1.f)
+        {
+            const size_t len =
+                snprintf(ret.data(), ret.size(), "%7.03f", value * factor);
+            ret.resize(len);
+        }
+        else
+        {
+            const size_t len = snprintf(ret.data(), ret.size(), "%7d",
+                                        (int)(value * factor));
+            ret.resize(len);
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Decode the a{sv} dictionary into the properties
+ *
+ * @param m     - Message positioned at the dictionary
+ * @param prev  - Previous entries, their nodes are reused
+ * @param props - Properties to add the entries to
+ *
+ * @return negative errno on malformed message
+ */
+static int decodeDict(sd_bus_message* m, PropertiesMap& prev,
+                      Properties& props)
+{
+    int rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{sv}");
+    while (rc >= 0 &&
+           (rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY,
+                                                "sv")) > 0)
+    {
+        const char* name;
+        const char* contents;
+        rc = sd_bus_message_read_basic(m, SD_BUS_TYPE_STRING, &name);
+        if (rc >= 0)
+        {
+            rc = sd_bus_message_peek_type(m, nullptr, &contents);
+        }
+        if (rc < 0)
+        {
+            break;
+        }
+
+        auto it = props.end();
+        const char type = contents[1] ? '\0' : contents[0];
+        switch (type)
+        {
+            case SD_BUS_TYPE_INT64:
+            case SD_BUS_TYPE_DOUBLE:
+            case SD_BUS_TYPE_BOOLEAN:
+            case SD_BUS_TYPE_STRING:
+                if (auto node = prev.extract(std::string_view(name)))
+                {
+                    node.key() = name;
+                    it = props.insert(std::move(node)).position;
+                }
+                else
+                {
+                    it = props.emplace(name, PropertyValue()).first;
+                }
+                break;
+            default:
+                it = props.end();
+                break;
+        }
+
+        if (it == props.end())
+        {
+            rc = sd_bus_message_skip(m, "v");
+        }
+        else if ((rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_VARIANT,
+                                                      contents)) >= 0)
+        {
+            PropertyValue& value = it->second;
+            if (type == SD_BUS_TYPE_INT64)
+            {
+                int64_t num = 0;
+                rc = sd_bus_message_read_basic(m, type, &num);
+                value = num;
+            }
+            else if (type == SD_BUS_TYPE_DOUBLE)
+            {
+                double num = 0;
+                rc = sd_bus_message_read_basic(m, type, &num);
+                value = num;
+            }
+            else if (type == SD_BUS_TYPE_BOOLEAN)
+            {
+                int flag = 0;
+                rc = sd_bus_message_read_basic(m, type, &flag);
+                value = flag != 0;
+            }
+            else
+            {
+                const char* str = "";
+                rc = sd_bus_message_read_basic(m, type, &str);
+                value = std::string_view(str);
+            }
+            if (rc >= 0)
+            {
+                rc = sd_bus_message_exit_container(m);
+            }
+        }
+        if (rc >= 0)
+        {
+            rc = sd_bus_message_exit_container(m);
+        }
+    }
+    if (rc >= 0)
+    {
+        rc = sd_bus_message_exit_container(m);
+    }
+    return rc;
+}
+
+int decodeProperties(sd_bus_message* m, Properties& props)
+{
+    // The previous entries are still borrowed from the previous message
+    // which is kept alive until the entries are rebuilt
+    Properties prev(std::move(props));
+    props.clear();
+
+    const int rc = decodeDict(m, prev, props);
+    props.borrow(m);
+    return rc;
+}
+
+int getProperties(const std::string& service, const std::string& path,
+                  Properties& props)
+{
+    auto m = bus().new_method_call(service.c_str(), path.c_str(),
+                                       SYSTEMD_PROPERTIES, "GetAll");
+    m.append("");
+    auto r = bus().call(m);
+
+    if (r.is_method_error())
+    {
+        return -sd_bus_message_get_errno(r.get());
+    }
+
+    return decodeProperties(r.get(), props);
+}
+
+int connectBus(const char* host)
+{
+    sd_bus* conn = nullptr;
+    int rc;
+    if (host)
+    {
+#ifdef WITH_REMOTE_HOST
+        rc = sd_bus_open_system_remote(&conn, host);
+#else
+        rc = -EOPNOTSUPP;
+#endif
+    }
+    else
+    {
+        rc = sd_bus_open_system(&conn);
+    }
+    if (rc >= 0)
+    {
+        systemBus.emplace(conn, std::false_type());
+        remoteHost = host;
+    }
+    return rc;
+}
+
+bool isConnectionLost(const sdbusplus::exception::SdBusError& ex)
+{
+    switch (ex.get_errno())
+    {
+        case ECONNRESET:
+        case ENOTCONN:
+        case EPIPE:
+        case ESHUTDOWN:
+            return true;
+        default:
+            return sd_bus_is_open(bus().get_bus()) <= 0;
+    }
+}
+
+bool tryReconnect()
+{
+    if (connectBus(remoteHost) < 0)
+    {
+        return false;
+    }
+    try
+    {
+        auto m = bus().new_method_call("org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus.Peer", "Ping");
+        bus().call(m);
+        return true;
+    }
+    catch (const sdbusplus::exception::SdBusError&)
+    {
+        // the bus is not ready yet
+        return false;
+    }
+}
+
+bool reconnect(const std::function<bool()>& cancelled)
+{
+    useconds_t delay = RECONNECT_MIN_DELAY;
+    while (!tryReconnect())
+    {
+        if (cancelled && cancelled())
+        {
+            return false;
+        }
+        usleep(delay);
+        delay = std::min(delay * 2, RECONNECT_MAX_DELAY);
+        if (cancelled && cancelled())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string resolveService(const std::string& path)
+{
+    auto m = bus().new_method_call(MAPPER_SERVICE, MAPPER_PATH,
+                                       MAPPER_IFACE, "GetObject");
+    m.append(path, std::vector<std::string>({SENSOR_VALUE_IFACE}));
+
+    std::map<std::string, std::vector<std::string>> services;
+    try
+    {
+        bus().call(m).read(services);
+    }
+    catch (const sdbusplus::exception::SdBusError& ex)
+    {
+        if (isConnectionLost(ex))
+        {
+            throw;
+        }
+    }
+    return services.empty() ? std::string() : services.begin()->first;
+}
+
+int revalidateSample(Sample& sample)
+{
+    std::string service = resolveService(sample.path);
+    if (service.empty())
+    {
+        return 0;
+    }
+    sample.service = std::move(service);
+    sample.props.clear();
+    try
+    {
+        return getProperties(sample.service, sample.path, sample.props);
+    }
+    catch (const sdbusplus::exception::SdBusError& ex)
+    {
+        if (isConnectionLost(ex))
+        {
+            throw;
+        }
+    }
+    return 0;
+}
+
+uint64_t monotonicUsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool CmpSensorsName::operator()(const std::string& a,
+                                const std::string& b) const
+{
+    const char* strA = a.c_str();
+    const char* strB = b.c_str();
+    while (true)
+    {
+        const char& chrA = *strA;
+        const char& chrB = *strB;
+
+        // check for end of name
+        if (!chrA || !chrB)
+        {
+            return !!chrB;
+        }
+
+        const bool isNumA = (chrA >= '0' && chrA <= '9');
+        const bool isNumB = (chrB >= '0' && chrB <= '9');
+
+        if (isNumA && isNumB)
+        {
+            // both names have numbers at the same position
+            char* endA = nullptr;
+            char* endB = nullptr;
+            const unsigned long valA = strtoul(strA, &endA, 10);
+            const unsigned long valB = strtoul(strB, &endB, 10);
+
+            if (valA != valB)
+            {
+                return valA < valB;
+            }
+
+            strA = endA;
+            strB = endB;
+        }
+        else if (isNumA || isNumB)
+        {
+            // only one of names has a number
+            return isNumA;
+        }
+        else
+        {
+            // no digits at position
+            if (chrA != chrB)
+            {
+                return chrA < chrB;
+            }
+
+            ++strA;
+            ++strB;
+        }
+    }
+}
+
+std::string sensorsPath(const std::string& type)
+{
+    std::string ret = SENSORS_PATH;
+    if (!type.empty())
+    {
+        ret += "/";
+        ret += type;
+    }
+    return ret;
+}
+
+void discover(const std::string& root_path, Topology& topology,
+              uint64_t timeout)
+{
+    auto method = bus().new_method_call(MAPPER_SERVICE, MAPPER_PATH,
+                                            MAPPER_IFACE, "GetSubTree");
+    const std::vector<std::string> ifaces = {SENSOR_VALUE_IFACE};
+    method.append(root_path, 0, ifaces);
+
+    topology.objects.clear();
+    topology.inventory.clear();
+    bus().call(method, timeout).read(topology.objects);
+}
+
+struct ManagedDiscovery;
+
+/**
+ * @brief GetManagedObjects request of the managed discovery
+ */
+struct ManagedRequest
+{
+    ManagedDiscovery* owner;
+    // Well-known name of the service
+    std::string service;
+    // Object manager paths left to try
+    std::vector<const char*> paths;
+    sd_bus_slot* slot = nullptr;
+};
+
+/**
+ * @brief Managed discovery state shared by the reply handlers
+ */
+struct ManagedDiscovery
+{
+    const std::string& root_path;
+    uint64_t timeout;
+    std::deque<ManagedRequest> requests;
+    // Discovered sensors with their owner's unique name
+    std::vector<std::pair<std::string, Sample>> found;
+    std::map<std::pair<Path, Service>, Interfaces> interfaces;
+    size_t pending = 0;
+    size_t failures = 0;
+    // Failure of a reply handler, thrown out of the bus processing
+    std::exception_ptr error;
+
+    /**
+     * @brief Ask the service for its objects at the next manager path
+     *
+     * @return false if there are no more paths to try
+     */
+    bool issue(ManagedRequest& req)
+    {
+        if (req.paths.empty())
+        {
+            return false;
+        }
+        auto m = bus().new_method_call(req.service.c_str(),
+                                           req.paths.front(),
+                                           "org.freedesktop.DBus.ObjectManager",
+                                           "GetManagedObjects");
+        req.paths.erase(req.paths.begin());
+        const int rc = sd_bus_call_async(bus().get_bus(), &req.slot,
+                                         m.get(), onReply, &req, timeout);
+        if (rc < 0)
+        {
+            throw sdbusplus::exception::SdBusError(-rc, "sd_bus_call_async");
+        }
+        ++pending;
+        return true;
+    }
+
+    static int onReply(sd_bus_message* m, void* data, sd_bus_error*)
+    {
+        auto& req = *static_cast<ManagedRequest*>(data);
+        auto& self = *req.owner;
+        --self.pending;
+        req.slot = sd_bus_slot_unref(req.slot);
+        // Exceptions must not pass through the sd-bus dispatching
+        try
+        {
+            if (sd_bus_message_is_method_error(m, nullptr))
+            {
+                // No object manager there, try the next path
+                if (!self.issue(req))
+                {
+                    ++self.failures;
+                }
+            }
+            else if (self.decode(m, req.service) < 0)
+            {
+                ++self.failures;
+            }
+        }
+        catch (...)
+        {
+            if (!self.error)
+            {
+                self.error = std::current_exception();
+            }
+        }
+        return 1;
+    }
+
+    /**
+     * @brief Decode the sensors from the GetManagedObjects reply
+     */
+    int decode(sd_bus_message* m, const std::string& service)
+    {
+        const char* owner = sd_bus_message_get_sender(m);
+        PropertiesMap none;
+        int rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY,
+                                                "{oa{sa{sv}}}");
+        while (rc >= 0 &&
+               (rc = sd_bus_message_enter_container(
+                    m, SD_BUS_TYPE_DICT_ENTRY, "oa{sa{sv}}")) > 0)
+        {
+            const char* path;
+            rc = sd_bus_message_read_basic(m, SD_BUS_TYPE_OBJECT_PATH, &path);
+            if (rc < 0)
+            {
+                break;
+            }
+            if (strncmp(path, root_path.c_str(), root_path.size()) ||
+                path[root_path.size()] != '/')
+            {
+                rc = sd_bus_message_skip(m, "a{sa{sv}}");
+            }
+            else
+            {
+                Sample sample{path, service, {}, {}};
+                Interfaces ifaces;
+                bool sensor = false;
+                rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY,
+                                                    "{sa{sv}}");
+                while (rc >= 0 &&
+                       (rc = sd_bus_message_enter_container(
+                            m, SD_BUS_TYPE_DICT_ENTRY, "sa{sv}")) > 0)
+                {
+                    const char* iface;
+                    rc = sd_bus_message_read_basic(m, SD_BUS_TYPE_STRING,
+                                                   &iface);
+                    if (rc >= 0)
+                    {
+                        ifaces.emplace_back(iface);
+                        sensor |= !strcmp(iface, SENSOR_VALUE_IFACE);
+                        rc = decodeDict(m, none, sample.props);
+                    }
+                    if (rc >= 0)
+                    {
+                        rc = sd_bus_message_exit_container(m);
+                    }
+                }
+                if (rc >= 0)
+                {
+                    rc = sd_bus_message_exit_container(m);
+                }
+                if (rc >= 0 && sensor)
+                {
+                    sample.props.borrow(m);
+                    interfaces[{sample.path, service}] = std::move(ifaces);
+                    found.emplace_back(owner ? owner : service,
+                                       std::move(sample));
+                }
+            }
+            if (rc >= 0)
+            {
+                rc = sd_bus_message_exit_container(m);
+            }
+        }
+        if (rc >= 0)
+        {
+            rc = sd_bus_message_exit_container(m);
+        }
+        return rc;
+    }
+};
+
+size_t discoverManaged(const std::string& root_path,
+                       const std::vector<std::string>& services,
+                       Topology& topology, Samples& samples,
+                       uint64_t timeout)
+{
+    std::vector<std::string> names;
+    auto m = bus().new_method_call("org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus", "ListNames");
+    bus().call(m).read(names);
+
+    ManagedDiscovery discovery{root_path, timeout, {}, {}, {}, 0, 0, nullptr};
+    for (const auto& name : names)
+    {
+        // Unique names duplicate the well-known ones
+        if (name[0] == ':' || name == "org.freedesktop.DBus" ||
+            name == MAPPER_SERVICE)
+        {
+            continue;
+        }
+        if (!services.empty() &&
+            std::none_of(services.begin(), services.end(),
+                         [&name](const std::string& glob) {
+                             return !fnmatch(glob.c_str(), name.c_str(), 0);
+                         }))
+        {
+            continue;
+        }
+        discovery.requests.push_back(
+            {&discovery, name, {"/", SENSORS_PATH}, nullptr});
+    }
+
+    // The calls bypass the fetch limiter: every service has a single call
+    // outstanding at a time, which is within any per-service cap, and the
+    // number of services bounds the burst
+    try
+    {
+        for (auto& req : discovery.requests)
+        {
+            discovery.issue(req);
+        }
+        while (discovery.pending && !discovery.error)
+        {
+            const int rc = sd_bus_process(bus().get_bus(), nullptr);
+            if (rc < 0)
+            {
+                throw sdbusplus::exception::SdBusError(-rc, "sd_bus_process");
+            }
+            if (rc == 0 && !discovery.error)
+            {
+                sd_bus_wait(bus().get_bus(), UINT64_MAX);
+            }
+        }
+        if (discovery.error)
+        {
+            std::rethrow_exception(discovery.error);
+        }
+    }
+    catch (...)
+    {
+        for (auto& req : discovery.requests)
+        {
+            sd_bus_slot_unref(req.slot);
+        }
+        throw;
+    }
+
+    // The process owning several names answers for each of them
+    auto& found = discovery.found;
+    CmpSensorsName less;
+    std::sort(found.begin(), found.end(), [&less](const auto& a, const auto& b) {
+        if (a.second.path != b.second.path)
+        {
+            return less(a.second.path, b.second.path);
+        }
+        return a.first != b.first ? a.first < b.first
+                                  : a.second.service < b.second.service;
+    });
+    found.erase(std::unique(found.begin(), found.end(),
+                            [](const auto& a, const auto& b) {
+                                return a.first == b.first &&
+                                       a.second.path == b.second.path;
+                            }),
+                found.end());
+
+    topology.objects.clear();
+    topology.inventory.clear();
+    samples.clear();
+    samples.reserve(found.size());
+    for (auto& [owner, sample] : found)
+    {
+        topology.objects[sample.path][sample.service] = std::move(
+            discovery.interfaces[{sample.path, sample.service}]);
+        samples.push_back(std::move(sample));
+    }
+    return discovery.failures;
+}
+
+/**
+ * @brief Service owner query
+ */
+struct OwnerCall
+{
+    // Unique name to set
+    std::string* owner;
+    // Number of the calls in flight
+    size_t* pending;
+    sd_bus_slot* slot = nullptr;
+
+    static int onReply(sd_bus_message* m, void* userdata, sd_bus_error*)
+    {
+        auto call = static_cast<OwnerCall*>(userdata);
+        const char* name = nullptr;
+        if (!sd_bus_message_is_method_error(m, nullptr) &&
+            sd_bus_message_read_basic(m, SD_BUS_TYPE_STRING, &name) >= 0)
+        {
+            *call->owner = name;
+        }
+        --*call->pending;
+        return 0;
+    }
+};
+
+void resolveOwners(const Samples& samples,
+                   std::map<Service, std::string>& owners)
+{
+    std::vector<OwnerCall> calls;
+    calls.reserve(samples.size());
+    size_t pending = 0;
+    for (const auto& sample : samples)
+    {
+        auto [it, added] = owners.try_emplace(sample.service);
+        if (!added)
+        {
+            continue;
+        }
+        OwnerCall& call = calls.emplace_back(OwnerCall{&it->second, &pending});
+        if (sd_bus_call_method_async(
+                bus().get_bus(), &call.slot, "org.freedesktop.DBus",
+                "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                "GetNameOwner", OwnerCall::onReply, &call, "s",
+                sample.service.c_str()) >= 0)
+        {
+            ++pending;
+        }
+    }
+    while (pending)
+    {
+        const int rc = sd_bus_process(bus().get_bus(), nullptr);
+        if (rc < 0 ||
+            (rc == 0 && sd_bus_wait(bus().get_bus(), UINT64_MAX) < 0))
+        {
+            break;
+        }
+    }
+    for (auto& call : calls)
+    {
+        sd_bus_slot_unref(call.slot);
+    }
+    // The services not on the bus yet are asked again next time
+    for (auto it = owners.begin(); it != owners.end();)
+    {
+        it = it->second.empty() ? owners.erase(it) : std::next(it);
+    }
+}
+
+/**
+ * @brief Read the endpoints of the association, leniently
+ *
+ * @param m         - Message at the property variant
+ * @param endpoints - Endpoints storage, left as is for other types
+ *
+ * @return negative error code on malformed message
+ */
+static int readEndpoints(sd_bus_message* m, std::vector<std::string>& endpoints)
+{
+    char type;
+    const char* contents;
+    int rc = sd_bus_message_peek_type(m, &type, &contents);
+    if (rc <= 0)
+    {
+        return rc < 0 ? rc : -EBADMSG;
+    }
+    if (type != SD_BUS_TYPE_VARIANT || strcmp(contents, "as"))
+    {
+        return sd_bus_message_skip(m, "v");
+    }
+    rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_VARIANT, "as");
+    if (rc >= 0)
+    {
+        rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "s");
+    }
+    const char* item;
+    while (rc >= 0 &&
+           (rc = sd_bus_message_read_basic(m, SD_BUS_TYPE_STRING, &item)) > 0)
+    {
+        endpoints.emplace_back(item);
+    }
+    if (rc >= 0)
+    {
+        rc = sd_bus_message_exit_container(m);
+    }
+    if (rc >= 0)
+    {
+        rc = sd_bus_message_exit_container(m);
+    }
+    return rc;
+}
+
+/**
+ * @brief Get the sensor path and the kind of the association object
+ *
+ * @return false if it is not an inventory or chassis association
+ */
+static bool parseAssociation(const std::string& path, std::string& sensor,
+                             bool& chassis)
+{
+    const size_t name_pos = path.rfind('/');
+    if (name_pos == std::string::npos)
+    {
+        return false;
+    }
+    const std::string_view name(path.c_str() + name_pos + 1);
+    if (name != "inventory" && name != "chassis")
+    {
+        return false;
+    }
+    sensor = path.substr(0, name_pos);
+    chassis = name == "chassis";
+    return true;
+}
+
+/**
+ * @brief Set the inventory item of the sensor
+ *
+ * The inventory association is preferred over the chassis one.
+ */
+static void setInventory(Topology& topology, const std::string& sensor,
+                         bool chassis,
+                         const std::vector<std::string>& endpoints)
+{
+    if (endpoints.empty() ||
+        topology.objects.find(sensor) == topology.objects.end())
+    {
+        return;
+    }
+    auto [it, added] = topology.inventory.try_emplace(sensor,
+                                                      endpoints.front());
+    if (!added && !chassis)
+    {
+        it->second = endpoints.front();
+    }
+}
+
+/**
+ * @brief Decode the associations from the mapper's GetManagedObjects reply
+ *
+ * The properties of unexpected types are skipped.
+ */
+static int decodeAssociations(sd_bus_message* m, Topology& topology)
+{
+    int rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY,
+                                            "{oa{sa{sv}}}");
+    while (rc >= 0 &&
+           (rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY,
+                                                "oa{sa{sv}}")) > 0)
+    {
+        const char* path;
+        std::string sensor;
+        bool chassis;
+        rc = sd_bus_message_read_basic(m, SD_BUS_TYPE_OBJECT_PATH, &path);
+        if (rc >= 0 && !parseAssociation(path, sensor, chassis))
+        {
+            rc = sd_bus_message_skip(m, "a{sa{sv}}");
+        }
+        else if (rc >= 0)
+        {
+            std::vector<std::string> endpoints;
+            rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY,
+                                                "{sa{sv}}");
+            while (rc >= 0 &&
+                   (rc = sd_bus_message_enter_container(
+                        m, SD_BUS_TYPE_DICT_ENTRY, "sa{sv}")) > 0)
+            {
+                const char* iface;
+                rc = sd_bus_message_read_basic(m, SD_BUS_TYPE_STRING, &iface);
+                if (rc >= 0 && strcmp(iface, ASSOCIATION_IFACE))
+                {
+                    rc = sd_bus_message_skip(m, "a{sv}");
+                }
+                else if (rc >= 0)
+                {
+                    rc = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY,
+                                                        "{sv}");
+                    while (rc >= 0 &&
+                           (rc = sd_bus_message_enter_container(
+                                m, SD_BUS_TYPE_DICT_ENTRY, "sv")) > 0)
+                    {
+                        const char* name;
+                        rc = sd_bus_message_read_basic(m, SD_BUS_TYPE_STRING,
+                                                       &name);
+                        if (rc >= 0)
+                        {
+                            rc = strcmp(name, "endpoints")
+                                     ? sd_bus_message_skip(m, "v")
+                                     : readEndpoints(m, endpoints);
+                        }
+                        if (rc >= 0)
+                        {
+                            rc = sd_bus_message_exit_container(m);
+                        }
+                    }
+                    if (rc >= 0)
+                    {
+                        rc = sd_bus_message_exit_container(m);
+                    }
+                }
+                if (rc >= 0)
+                {
+                    rc = sd_bus_message_exit_container(m);
+                }
+            }
+            if (rc >= 0)
+            {
+                rc = sd_bus_message_exit_container(m);
+            }
+            setInventory(topology, sensor, chassis, endpoints);
+        }
+        if (rc >= 0)
+        {
+            rc = sd_bus_message_exit_container(m);
+        }
+    }
+    if (rc >= 0)
+    {
+        rc = sd_bus_message_exit_container(m);
+    }
+    return rc;
+}
+
+/**
+ * @brief Association endpoints query, without the object manager
+ */
+struct EndpointsCall
+{
+    Topology* topology;
+    std::string sensor;
+    bool chassis;
+    // Number of the calls in flight
+    size_t* pending;
+    sd_bus_slot* slot = nullptr;
+
+    static int onReply(sd_bus_message* m, void* userdata, sd_bus_error*)
+    {
+        auto call = static_cast<EndpointsCall*>(userdata);
+        std::vector<std::string> endpoints;
+        // No such association is not an error
+        if (!sd_bus_message_is_method_error(m, nullptr) &&
+            readEndpoints(m, endpoints) >= 0)
+        {
+            setInventory(*call->topology, call->sensor, call->chassis,
+                         endpoints);
+        }
+        --*call->pending;
+        return 0;
+    }
+};
+
+/**
+ * @brief Get the associations of every sensor, all the calls at once
+ */
+static bool getAssociations(Topology& topology)
+{
+    std::deque<EndpointsCall> calls;
+    size_t pending = 0;
+    for (const auto& obj : topology.objects)
+    {
+        for (const bool chassis : {false, true})
+        {
+            EndpointsCall& call = calls.emplace_back(
+                EndpointsCall{&topology, obj.first, chassis, &pending});
+            const std::string path =
+                obj.first + (chassis ? "/chassis" : "/inventory");
+            if (sd_bus_call_method_async(
+                    bus().get_bus(), &call.slot, MAPPER_SERVICE, path.c_str(),
+                    SYSTEMD_PROPERTIES, "Get", EndpointsCall::onReply, &call,
+                    "ss", ASSOCIATION_IFACE, "endpoints") >= 0)
+            {
+                ++pending;
+            }
+        }
+    }
+    bool ok = true;
+    while (pending)
+    {
+        const int rc = sd_bus_process(bus().get_bus(), nullptr);
+        if (rc < 0 ||
+            (rc == 0 && sd_bus_wait(bus().get_bus(), UINT64_MAX) < 0))
+        {
+            ok = false;
+            break;
+        }
+    }
+    for (auto& call : calls)
+    {
+        sd_bus_slot_unref(call.slot);
+    }
+    return ok;
+}
+
+bool resolveInventory(Topology& topology)
+{
+    sd_bus_message* reply = nullptr;
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    int rc = sd_bus_call_method(bus().get_bus(), MAPPER_SERVICE, "/",
+                                "org.freedesktop.DBus.ObjectManager",
+                                "GetManagedObjects", &error, &reply, "");
+    sd_bus_error_free(&error);
+    if (rc < 0)
+    {
+        // The mapper hosts no object manager, ask every association
+        return getAssociations(topology);
+    }
+    rc = decodeAssociations(reply, topology);
+    sd_bus_message_unref(reply);
+    return rc >= 0;
+}
+
+Samples makeSamples(const Topology& topology)
+{
+    Samples samples;
+    for (const auto& obj : topology.objects)
+    {
+        auto item = topology.inventory.find(obj.first);
+        for (const auto& service : obj.second)
+        {
+            samples.push_back({obj.first, service.first, {},
+                               item != topology.inventory.end() ? item->second
+                                                                : Path()});
+        }
+    }
+    return samples;
+}
+
+FetchPriority::FetchPriority() :
+    criteria{Criterion::tag, Criterion::status, Criterion::type}
+{
+}
+
+bool FetchPriority::setCriteria(const std::string& list)
+{
+    criteria.clear();
+    size_t start;
+    size_t end = 0;
+    while ((start = list.find_first_not_of(',', end)) != std::string::npos)
+    {
+        end = list.find(',', start);
+        const std::string name = list.substr(start, end - start);
+        if (name == "tag")
+        {
+            criteria.push_back(Criterion::tag);
+        }
+        else if (name == "status")
+        {
+            criteria.push_back(Criterion::status);
+        }
+        else if (name == "type")
+        {
+            criteria.push_back(Criterion::type);
+        }
+        else if (name != "none")
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FetchPriority::addTag(const std::string& tag)
+{
+    tags.push_back(tag);
+}
+
+unsigned FetchPriority::rank(const Sample& sample) const
+{
+    const size_t name_pos = sample.path.rfind('/');
+    unsigned ret = 0;
+    for (const auto criterion : criteria)
+    {
+        ret <<= 8;
+        switch (criterion)
+        {
+            case Criterion::tag:
+                ret |= tagRank(sample.path.c_str() + name_pos + 1);
+                break;
+            case Criterion::status:
+                ret |= statusRank(sample.props);
+                break;
+            case Criterion::type:
+                ret |= typeRank(sample.path, name_pos);
+                break;
+        }
+    }
+    return ret;
+}
+
+unsigned FetchPriority::tagRank(const char* name) const
+{
+    for (const auto& tag : tags)
+    {
+        if (!fnmatch(tag.c_str(), name, 0))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+unsigned FetchPriority::statusRank(const Properties& props)
+{
+    if (props.empty())
+    {
+        // Not fetched yet
+        return 4;
+    }
+    switch (props.state())
+    {
+        case Status::fatal:
+            return 0;
+        case Status::critical:
+            return 1;
+        case Status::warning:
+            return 2;
+        case Status::ok:
+            return 4;
+        case Status::failed:
+        case Status::unavailable:
+            break;
+    }
+    return 3;
+}
+
+unsigned FetchPriority::typeRank(const std::string& path, size_t name_pos)
+{
+    static constexpr const char* types[] = {
+        "temperature", "power", "current", "fan_tach", "fan_pwm",
+        "voltage",
+    };
+
+    const size_t folder_pos = path.rfind('/', name_pos - 1);
+    const size_t len = name_pos - folder_pos - 1;
+    for (size_t i = 0; i < std::size(types); ++i)
+    {
+        if (!path.compare(folder_pos + 1, len, types[i]))
+        {
+            return static_cast<unsigned>(i);
+        }
+    }
+    return std::size(types);
+}
+
+struct Fetcher::Impl
+{
+    Impl(const Limits& limits, const FetchPriority& priority) :
+        limits(limits), priority(priority), tokens(limits.burst),
+        tokensTime(monotonicUsec())
+    {
+    }
+
+    ~Impl()
+    {
+        cancel(false);
+    }
+
+    void fetch(Samples& samples, const std::vector<bool>& skip,
+               const std::vector<Interfaces>& dynamic)
+    {
+        requests.assign(samples.size(), Request());
+        for (auto& [name, service] : services)
+        {
+            service.queue.clear();
+        }
+        pending = 0;
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            Request& req = requests[i];
+            if (i < skip.size() && skip[i])
+            {
+                req.done = true;
+                continue;
+            }
+            req.owner = this;
+            req.sample = &samples[i];
+            req.service = &services[req.sample->service];
+            req.service->queue.push_back({priority.rank(*req.sample), i});
+            // A single call per sensor in any case: several interfaces are
+            // got with all the properties
+            if (i < dynamic.size() && dynamic[i].size() == 1)
+            {
+                req.iface = dynamic[i].front().c_str();
+            }
+            ++pending;
+        }
+        for (auto& [name, service] : services)
+        {
+            std::sort(service.queue.begin(), service.queue.end());
+        }
+
+        deadline = limits.timeout
+                       ? monotonicUsec() + limits.timeout * 1000ull
+                       : UINT64_MAX;
+        try
+        {
+            while (pending)
+            {
+                uint64_t wait = dispatch();
+                const int rc = sd_bus_process(bus().get_bus(), nullptr);
+                if (rc < 0)
+                {
+                    throw sdbusplus::exception::SdBusError(-rc,
+                                                           "sd_bus_process");
+                }
+                if (rc > 0 || !pending)
+                {
+                    continue;
+                }
+
+                const uint64_t now = monotonicUsec();
+                if (now >= deadline)
+                {
+                    stats.timeouts += pending;
+                    cancel(true);
+                    break;
+                }
+                wait = std::min(wait, deadline - now);
+                sd_bus_wait(bus().get_bus(), wait);
+                ++stats.wakeups;
+            }
+        }
+        catch (...)
+        {
+            cancel(false);
+            throw;
+        }
+    }
+
+    bool failed(size_t index) const
+    {
+        return requests[index].failed;
+    }
+
+    bool timedOut(size_t index) const
+    {
+        return requests[index].timedOut;
+    }
+
+    unsigned timeout() const
+    {
+        return limits.timeout;
+    }
+
+    void setTimeout(unsigned timeout)
+    {
+        limits.timeout = timeout;
+    }
+
+    size_t wakeups() const
+    {
+        return stats.wakeups;
+    }
+
+    void printStats(FILE* out) const
+    {
+        fprintf(out,
+                "Limiter: %zu requests, %zu errors, peak %zu in flight, "
+                "%zu rate waits, %zu cap deferrals, %zu timeouts\n",
+                stats.requests, stats.errors, stats.peakInflight,
+                stats.rateWaits, stats.capDeferrals, stats.timeouts);
+        for (const auto& [name, service] : services)
+        {
+            fprintf(out,
+                    "  %s: %zu requests, cap %.1f (+%zu/-%zu), peak %zu, "
+                    "latency avg %.1f ms, max %.1f ms\n",
+                    name.c_str(), service.requests, service.cap,
+                    service.increases, service.decreases, service.peak,
+                    service.requests ? service.latencySum / 1000.0 /
+                                           service.requests
+                                     : 0.0,
+                    service.latencyMax / 1000.0);
+        }
+    }
+
+  private:
+    /**
+     * @brief Queued request
+     */
+    struct Queued
+    {
+        // Request rank by FetchPriority
+        unsigned rank;
+        // Request index
+        size_t index;
+
+        bool operator<(const Queued& other) const
+        {
+            return rank != other.rank ? rank < other.rank
+                                      : index < other.index;
+        }
+    };
+
+    /**
+     * @brief Per-service admission state
+     */
+    struct Service
+    {
+        // Queued requests in the order of issuing
+        std::deque<Queued> queue;
+        // Number of outstanding requests
+        size_t outstanding = 0;
+        // Current concurrency limit
+        double cap = 2;
+        // Lowest observed latency, us
+        uint64_t baseLatency = UINT64_MAX;
+        // Time of the last limit decrease
+        uint64_t decreasedAt = 0;
+
+        // Statistics
+        size_t requests = 0;
+        size_t peak = 0;
+        size_t increases = 0;
+        size_t decreases = 0;
+        uint64_t latencySum = 0;
+        uint64_t latencyMax = 0;
+    };
+
+    /**
+     * @brief Single GetAll request
+     */
+    struct Request
+    {
+        Impl* owner = nullptr;
+        Sample* sample = nullptr;
+        Service* service = nullptr;
+        sd_bus_slot* slot = nullptr;
+        uint64_t sent = 0;
+        // Interface to get the properties of, empty for all properties
+        const char* iface = "";
+        bool done = false;
+        bool failed = false;
+        bool timedOut = false;
+    };
+
+    /**
+     * @brief Issue all the requests allowed by the limiter
+     *
+     * @return time to wait for the next admission, us
+     */
+    uint64_t dispatch()
+    {
+        while (true)
+        {
+            if (monotonicUsec() >= deadline)
+            {
+                // The rest of the queue is dropped as timed out
+                return 0;
+            }
+
+            // The earliest queued request of the services under their caps
+            Service* next = nullptr;
+            bool capped = false;
+            for (auto& [name, service] : services)
+            {
+                if (service.queue.empty())
+                {
+                    continue;
+                }
+                if (service.outstanding >= static_cast<size_t>(service.cap))
+                {
+                    capped = true;
+                    continue;
+                }
+                if (!next || service.queue.front() < next->queue.front())
+                {
+                    next = &service;
+                }
+            }
+            if (!next)
+            {
+                stats.capDeferrals += capped;
+                return UINT64_MAX;
+            }
+
+            const uint64_t wait = takeToken();
+            if (wait)
+            {
+                ++stats.rateWaits;
+                return wait;
+            }
+
+            const size_t index = next->queue.front().index;
+            next->queue.pop_front();
+            issue(requests[index]);
+        }
+    }
+
+    /**
+     * @brief Take the token from the bucket
+     *
+     * @return 0 if the token is taken, or time to wait for the token, us
+     */
+    uint64_t takeToken()
+    {
+        if (!limits.rate)
+        {
+            return 0;
+        }
+        const uint64_t now = monotonicUsec();
+        tokens = std::min<double>(tokens + (now - tokensTime) * limits.rate /
+                                               1000000.0,
+                                  std::max(limits.burst, 1u));
+        tokensTime = now;
+        if (tokens >= 1)
+        {
+            tokens -= 1;
+            return 0;
+        }
+        return static_cast<uint64_t>((1 - tokens) * 1000000 / limits.rate) +
+               1;
+    }
+
+    /**
+     * @brief Send the request
+     *
+     * @param req - Request to send
+     */
+    void issue(Request& req)
+    {
+        req.sent = monotonicUsec();
+        const int rc = send(req);
+        if (rc < 0)
+        {
+            throw sdbusplus::exception::SdBusError(-rc, "sd_bus_call_async");
+        }
+
+        Service& service = *req.service;
+        ++service.outstanding;
+        ++service.requests;
+        service.peak = std::max(service.peak, service.outstanding);
+        ++stats.requests;
+        ++inflight;
+        stats.peakInflight = std::max(stats.peakInflight, inflight);
+    }
+
+    /**
+     * @brief Send the call of the request
+     *
+     * @param req - Request to send
+     *
+     * @return negative errno on failure
+     */
+    int send(Request& req)
+    {
+        sd_bus_message* m = nullptr;
+        int rc = sd_bus_message_new_method_call(
+            bus().get_bus(), &m, req.sample->service.c_str(),
+            req.sample->path.c_str(), SYSTEMD_PROPERTIES, "GetAll");
+        if (rc >= 0)
+        {
+            rc = sd_bus_message_append_basic(m, SD_BUS_TYPE_STRING,
+                                             req.iface);
+        }
+        if (rc >= 0)
+        {
+            // The whole sweep deadline is the limit for every request
+            const uint64_t now = monotonicUsec();
+            const uint64_t timeout =
+                deadline == UINT64_MAX
+                    ? 0
+                    : std::max<uint64_t>(deadline - std::min(deadline, now),
+                                         1);
+            rc = sd_bus_call_async(bus().get_bus(), &req.slot, m,
+                                   onReply, &req, timeout);
+        }
+        sd_bus_message_unref(m);
+        return rc;
+    }
+
+    /**
+     * @brief Async reply handler
+     */
+    static int onReply(sd_bus_message* m, void* data, sd_bus_error*)
+    {
+        Request& req = *static_cast<Request*>(data);
+        req.owner->complete(req, m);
+        return 1;
+    }
+
+    /**
+     * @brief Handle the reply and adapt the service limit
+     */
+    void complete(Request& req, sd_bus_message* m)
+    {
+        req.slot = sd_bus_slot_unref(req.slot);
+        if (sd_bus_message_get_errno(m) == ETIMEDOUT ||
+            sd_bus_message_is_method_error(m, SD_BUS_ERROR_NO_REPLY))
+        {
+            // The sweep deadline has expired, the service is not blamed
+            finish(req);
+            req.failed = true;
+            req.timedOut = true;
+            req.sample->props.clear();
+            ++stats.timeouts;
+            return;
+        }
+
+        if (sd_bus_message_is_method_error(m, nullptr) ||
+            decodeProperties(m, req.sample->props) < 0)
+        {
+            req.failed = true;
+            req.sample->props.clear();
+            ++stats.errors;
+        }
+
+        const uint64_t now = monotonicUsec();
+        const uint64_t latency = now - req.sent;
+        Service& service = *req.service;
+        finish(req);
+
+        service.latencySum += latency;
+        service.latencyMax = std::max(service.latencyMax, latency);
+        service.baseLatency = std::min(service.baseLatency, latency);
+
+        // Latency well above the best one means the service is saturated
+        const uint64_t target =
+            std::max(service.baseLatency * 2, service.baseLatency + 5000);
+        if (req.failed || latency > target)
+        {
+            // Decrease once per round trip: the replies to requests sent
+            // before the previous decrease reflect the old limit
+            if (req.sent > service.decreasedAt)
+            {
+                service.cap = std::max(service.cap / 2, 1.0);
+                service.decreasedAt = now;
+                ++service.decreases;
+            }
+        }
+        else if (service.cap < limits.maxInflight)
+        {
+            service.cap = std::min<double>(service.cap + 1 / service.cap,
+                                           limits.maxInflight);
+            ++service.increases;
+        }
+    }
+
+    /**
+     * @brief Release the admission of the completed request
+     */
+    void finish(Request& req)
+    {
+        req.done = true;
+        --req.service->outstanding;
+        --inflight;
+        --pending;
+    }
+
+    /**
+     * @brief Drop all outstanding and queued requests
+     *
+     * @param timeout - Requests are dropped due to the sweep timeout
+     */
+    void cancel(bool timeout)
+    {
+        for (auto& req : requests)
+        {
+            if (req.slot)
+            {
+                req.slot = sd_bus_slot_unref(req.slot);
+                --req.service->outstanding;
+            }
+            if (!req.done)
+            {
+                req.done = true;
+                req.failed = true;
+                req.timedOut = timeout;
+                req.sample->props.clear();
+            }
+        }
+        inflight = 0;
+        pending = 0;
+    }
+
+    Limits limits;
+    FetchPriority priority;
+    std::map<std::string, Service> services;
+    std::vector<Request> requests;
+    // Sweep deadline, us
+    uint64_t deadline = UINT64_MAX;
+    size_t pending = 0;
+    size_t inflight = 0;
+    double tokens;
+    uint64_t tokensTime;
+
+    struct
+    {
+        size_t requests = 0;
+        size_t errors = 0;
+        size_t peakInflight = 0;
+        size_t rateWaits = 0;
+        size_t capDeferrals = 0;
+        size_t timeouts = 0;
+        size_t wakeups = 0;
+    } stats;
+};
+
+Fetcher::Fetcher(const FetchPriority& priority) : Fetcher(Limits(), priority)
+{
+}
+
+Fetcher::Fetcher(const Limits& limits, const FetchPriority& priority) :
+    impl(std::make_unique<Impl>(limits, priority))
+{
+}
+
+Fetcher::~Fetcher() = default;
+
+void Fetcher::fetch(Samples& samples, const std::vector<bool>& skip,
+                    const std::vector<Interfaces>& dynamic)
+{
+    impl->fetch(samples, skip, dynamic);
+}
+
+unsigned Fetcher::timeout() const
+{
+    return impl->timeout();
+}
+
+void Fetcher::setTimeout(unsigned timeout)
+{
+    impl->setTimeout(timeout);
+}
+
+bool Fetcher::failed(size_t index) const
+{
+    return impl->failed(index);
+}
+
+bool Fetcher::timedOut(size_t index) const
+{
+    return impl->timedOut(index);
+}
+
+size_t Fetcher::wakeups() const
+{
+    return impl->wakeups();
+}
+
+void Fetcher::printStats(FILE* out) const
+{
+    impl->printStats(out);
+}
+
+NegativeCache::NegativeCache(uint64_t minDelay, uint64_t maxDelay) :
+    minDelay(minDelay), maxDelay(maxDelay)
+{}
+
+void NegativeCache::skip(const Samples& samples, uint64_t now,
+                         std::vector<bool>& mask) const
+{
+    mask.resize(samples.size(), false);
+    if (entries.empty())
+    {
+        return;
+    }
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        auto it = entries.find(samples[i].path);
+        // The entries saved with a longer backoff are not trusted
+        if (it != entries.end() && it->second.retry > now &&
+            it->second.retry - now <= maxDelay)
+        {
+            mask[i] = true;
+        }
+    }
+}
+
+void NegativeCache::update(Samples& samples, const Fetcher& fetcher,
+                           const std::vector<bool>& mask, uint64_t now)
+{
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        Properties& props = samples[i].props;
+        if (i < mask.size() && mask[i])
+        {
+            props.clear();
+            props.emplace("Available", false);
+            props.emplace(CACHED_PROPERTY, true);
+            continue;
+        }
+        const bool negative = fetcher.failed(i) || fetcher.timedOut(i) ||
+                              props.state() == Status::unavailable;
+        auto it = entries.find(samples[i].path);
+        if (!negative)
+        {
+            if (it != entries.end())
+            {
+                entries.erase(it);
+            }
+        }
+        else if (it == entries.end())
+        {
+            entries.emplace(samples[i].path, Entry{now + minDelay, minDelay});
+        }
+        else
+        {
+            Entry& entry = it->second;
+            entry.delay = std::min(entry.delay * 2, maxDelay);
+            entry.retry = now + entry.delay;
+        }
+    }
+}
+
+void NegativeCache::subscribe(const std::string& root_path)
+{
+    auto onChange = [this](sdbusplus::message::message& m) {
+        entries.erase(m.get_path());
+    };
+    for (const char* iface : {AVAILABILITY_IFACE, OPERATIONAL_IFACE})
+    {
+        matches.push_back(std::make_unique<sdbusplus::bus::match::match>(
+            bus(),
+            "type='signal',interface='" + std::string(SYSTEMD_PROPERTIES) +
+                "',member='PropertiesChanged',path_namespace='" + root_path +
+                "',arg0='" + iface + "'",
+            onChange));
+    }
+    matches.push_back(std::make_unique<sdbusplus::bus::match::match>(
+        bus(),
+        "type='signal',interface='" + std::string(SYSTEMD_PROPERTIES) +
+            "',member='PropertiesChanged',path='" + HOST_PATH + "',arg0='" +
+            HOST_IFACE + "'",
+        [this](sdbusplus::message::message&) { entries.clear(); }));
+}
+
+/**
+ * @brief Get the current host state, empty if unknown
+ */
+static std::string hostState()
+{
+    char* state = nullptr;
+    std::string ret;
+    if (sd_bus_get_property_string(bus().get_bus(), HOST_SERVICE,
+                                   HOST_PATH, HOST_IFACE, "CurrentHostState",
+                                   nullptr, &state) >= 0)
+    {
+        ret = state;
+        free(state);
+    }
+    return ret;
+}
+
+std::string NegativeCache::save() const
+{
+    std::string ret = hostState() + '\n';
+    for (const auto& [path, entry] : entries)
+    {
+        ret += std::to_string(entry.retry) + ' ' +
+               std::to_string(entry.delay) + ' ' + path + '\n';
+    }
+    return ret;
+}
+
+void NegativeCache::load(const std::string& data)
+{
+    size_t end = data.find('\n');
+    if (end == std::string::npos || data.size() == end + 1 ||
+        data.compare(0, end, hostState()))
+    {
+        return;
+    }
+    size_t start = end + 1;
+    while ((end = data.find('\n', start)) != std::string::npos)
+    {
+        const std::string line = data.substr(start, end - start);
+        start = end + 1;
+        Entry entry;
+        int path = 0;
+        if (sscanf(line.c_str(), "%" SCNu64 " %" SCNu64 " %n", &entry.retry,
+                   &entry.delay, &path) == 2 &&
+            path)
+        {
+            entries.insert_or_assign(line.substr(path), entry);
+        }
+    }
+}
+
+/**
+ * @brief Check if the property changes while the service runs
+ */
+static bool isDynamic(std::string_view name)
+{
+    return name == "Value" || name == "Available" || name == "Functional" ||
+           name.find("Alarm") != std::string_view::npos;
+}
+
+/**
+ * @brief Get the interface the dynamic property belongs to
+ *
+ * The alarms of a threshold kind, like WarningAlarmHigh or
+ * HardShutdownAlarmLow, are on the threshold interface of the kind.
+ *
+ * @return interface name or empty if unknown
+ */
+static std::string dynamicInterface(std::string_view name)
+{
+    static constexpr std::pair<std::string_view, const char*> ifaces[] = {
+        {"Value", SENSOR_VALUE_IFACE},
+        {"Available", AVAILABILITY_IFACE},
+        {"Functional", OPERATIONAL_IFACE}};
+    for (const auto& [prop, iface] : ifaces)
+    {
+        if (name == prop)
+        {
+            return iface;
+        }
+    }
+    static constexpr std::string_view alarms[] = {
+        "Warning", "Critical", "Fatal", "HardShutdown", "SoftShutdown",
+        "PerformanceLoss"};
+    for (const auto& kind : alarms)
+    {
+        if (!name.compare(0, kind.size(), kind) &&
+            !name.compare(kind.size(), 5, "Alarm"))
+        {
+            return std::string(THRESHOLD_IFACE_PREFIX) + std::string(kind);
+        }
+    }
+    return std::string();
+}
+
+MetadataCache::MetadataCache(uint64_t ttl) : ttl(ttl) {}
+
+void MetadataCache::resolve(const Samples& samples)
+{
+    resolveOwners(samples, owners);
+}
+
+const std::string& MetadataCache::owner(const Service& service) const
+{
+    static const std::string none;
+    auto it = owners.find(service);
+    return it == owners.end() ? none : it->second;
+}
+
+void MetadataCache::select(const Samples& samples,
+                           std::vector<Interfaces>& dynamic)
+{
+    dynamic.assign(samples.size(), Interfaces());
+    if (entries.empty())
+    {
+        return;
+    }
+    resolve(samples);
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        auto it = entries.find(samples[i].path);
+        if (it == entries.end() || it->second.service != samples[i].service)
+        {
+            continue;
+        }
+        if (it->second.owner != owner(it->second.service))
+        {
+            entries.erase(it);
+            continue;
+        }
+        // Several interfaces would be got all at once anyway
+        if (it->second.ifaces.size() == 1)
+        {
+            dynamic[i] = it->second.ifaces;
+        }
+    }
+}
+
+void MetadataCache::apply(Samples& samples,
+                          const std::vector<Interfaces>& dynamic) const
+{
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        if (i >= dynamic.size() || dynamic[i].empty())
+        {
+            continue;
+        }
+        auto it = entries.find(samples[i].path);
+        Properties& props = samples[i].props;
+        if (it == entries.end() || props.find("Value") == props.end())
+        {
+            continue;
+        }
+        // The fetched properties, like the thresholds got along with the
+        // alarms, take precedence over the cached ones
+        for (const auto& [name, value] : it->second.props)
+        {
+            if (props.find(name) != props.end())
+            {
+                continue;
+            }
+            const std::string_view key = props.keep(std::string(name));
+            if (const auto str = std::get_if<std::string>(&value))
+            {
+                props.emplace(key, props.keep(std::string(*str)));
+            }
+            else if (const auto num = std::get_if<int64_t>(&value))
+            {
+                props.emplace(key, PropertyValue(*num));
+            }
+            else if (const auto num = std::get_if<double>(&value))
+            {
+                props.emplace(key, PropertyValue(*num));
+            }
+            else
+            {
+                props.emplace(key, PropertyValue(std::get<bool>(value)));
+            }
+        }
+    }
+}
+
+void MetadataCache::store(const Samples& samples, const Fetcher& fetcher,
+                          const std::vector<bool>& skip,
+                          const std::vector<Interfaces>& dynamic, uint64_t now)
+{
+    resolve(samples);
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        const Sample& sample = samples[i];
+        if (i < skip.size() && skip[i])
+        {
+            continue;
+        }
+        if (fetcher.failed(i) || fetcher.timedOut(i))
+        {
+            entries.erase(sample.path);
+            continue;
+        }
+        if (i < dynamic.size() && !dynamic[i].empty())
+        {
+            continue;
+        }
+
+        const std::string& name = owner(sample.service);
+        if (name.empty())
+        {
+            continue;
+        }
+        Entry& entry = entries[sample.path];
+        entry.service = sample.service;
+        entry.owner = name;
+        entry.stored = now;
+        entry.ifaces.clear();
+        entry.props.clear();
+        for (const auto& [key, value] : sample.props)
+        {
+            if (!isDynamic(key))
+            {
+                continue;
+            }
+            std::string iface = dynamicInterface(key);
+            if (iface.empty())
+            {
+                // Not known where to get it from, always fetch all
+                entry.ifaces.clear();
+                break;
+            }
+            if (std::find(entry.ifaces.begin(), entry.ifaces.end(), iface) ==
+                entry.ifaces.end())
+            {
+                entry.ifaces.push_back(std::move(iface));
+            }
+        }
+        // The sensors with the dynamic properties on several interfaces are
+        // got with a single call of all the properties, like uncached ones
+        if (entry.ifaces.size() != 1)
+        {
+            entries.erase(sample.path);
+            continue;
+        }
+        for (const auto& [key, value] : sample.props)
+        {
+            if (isDynamic(key))
+            {
+                continue;
+            }
+            if (const auto str = std::get_if<std::string_view>(&value))
+            {
+                entry.props.emplace_back(key, std::string(*str));
+            }
+            else if (const auto num = std::get_if<int64_t>(&value))
+            {
+                entry.props.emplace_back(key, *num);
+            }
+            else if (const auto num = std::get_if<double>(&value))
+            {
+                entry.props.emplace_back(key, *num);
+            }
+            else if (const auto flag = std::get_if<bool>(&value))
+            {
+                entry.props.emplace_back(key, *flag);
+            }
+        }
+    }
+}
+
+std::string MetadataCache::save() const
+{
+    // Line per sensor: path, service, owner, time, comma-separated dynamic
+    // interfaces, then name, type and value of each property, separated by
+    // tabs
+    std::string ret;
+    char num[32];
+    for (const auto& [path, entry] : entries)
+    {
+        ret += path + '\t' + entry.service + '\t' + entry.owner + '\t' +
+               std::to_string(entry.stored) + '\t';
+        for (size_t i = 0; i < entry.ifaces.size(); ++i)
+        {
+            ret += (i ? "," : "") + entry.ifaces[i];
+        }
+        for (const auto& [name, value] : entry.props)
+        {
+            ret += '\t' + name + '\t';
+            if (const auto str = std::get_if<std::string>(&value))
+            {
+                // The separators are escaped
+                ret += 's';
+                for (const char chr : *str)
+                {
+                    if (chr == '\t' || chr == '\n' || chr == '\\')
+                    {
+                        ret += '\\';
+                        ret += chr == '\t' ? 't' : chr == '\n' ? 'n' : '\\';
+                    }
+                    else
+                    {
+                        ret += chr;
+                    }
+                }
+            }
+            else if (const auto n = std::get_if<int64_t>(&value))
+            {
+                ret += 'x' + std::to_string(*n);
+            }
+            else if (const auto d = std::get_if<double>(&value))
+            {
+                snprintf(num, sizeof(num), "d%.17g", *d);
+                ret += num;
+            }
+            else
+            {
+                ret += std::get<bool>(value) ? "b1" : "b0";
+            }
+        }
+        ret += '\n';
+    }
+    return ret;
+}
+
+void MetadataCache::load(const std::string& data, uint64_t now)
+{
+    size_t start = 0;
+    size_t end;
+    std::vector<std::string> fields;
+    while ((end = data.find('\n', start)) != std::string::npos)
+    {
+        fields.clear();
+        size_t pos = start;
+        while (pos <= end)
+        {
+            const size_t tab = std::min(data.find('\t', pos), end);
+            fields.emplace_back(data, pos, tab - pos);
+            pos = tab + 1;
+        }
+        start = end + 1;
+
+        if (fields.size() < 5 || !(fields.size() % 2))
+        {
+            continue;
+        }
+        Entry entry;
+        entry.service = fields[1];
+        entry.owner = fields[2];
+        entry.stored = strtoull(fields[3].c_str(), nullptr, 10);
+        if (entry.stored > now || now - entry.stored >= ttl ||
+            fields[4].empty())
+        {
+            continue;
+        }
+        for (size_t pos = 0; pos <= fields[4].size();)
+        {
+            const size_t comma = std::min(fields[4].find(',', pos),
+                                          fields[4].size());
+            entry.ifaces.emplace_back(fields[4], pos, comma - pos);
+            pos = comma + 1;
+        }
+        bool valid = true;
+        for (size_t i = 5; i < fields.size() && valid; i += 2)
+        {
+            const std::string& value = fields[i + 1];
+            const char* str = value.c_str() + 1;
+            switch (value.empty() ? '\0' : value[0])
+            {
+                case 's': {
+                    std::string unescaped;
+                    for (; *str; ++str)
+                    {
+                        if (*str == '\\' && str[1])
+                        {
+                            ++str;
+                            unescaped += *str == 't'   ? '\t'
+                                         : *str == 'n' ? '\n'
+                                                       : *str;
+                        }
+                        else
+                        {
+                            unescaped += *str;
+                        }
+                    }
+                    entry.props.emplace_back(fields[i], std::move(unescaped));
+                    break;
+                }
+                case 'x':
+                    entry.props.emplace_back(
+                        fields[i], static_cast<int64_t>(strtoll(str, nullptr,
+                                                                10)));
+                    break;
+                case 'd':
+                    entry.props.emplace_back(fields[i], strtod(str, nullptr));
+                    break;
+                case 'b':
+                    entry.props.emplace_back(fields[i], *str == '1');
+                    break;
+                default:
+                    valid = false;
+                    break;
+            }
+        }
+        if (valid)
+        {
+            entries.insert_or_assign(fields[0], std::move(entry));
+        }
+    }
+}
+
+/**
+ * @brief Hwmon attribute kind and its relation to the sensors type
+ */
+struct HwmonKind
+{
+    // Attribute name prefix
+    const char* prefix;
+    // Sensors type folder
+    const char* type;
+    // Multiplier from the attribute units to the sensor units
+    double factor;
+};
+
+static constexpr HwmonKind HWMON_KINDS[] = {
+    {"temp", "temperature", 1e-3}, {"in", "voltage", 1e-3},
+    {"fan", "fan_tach", 1},        {"curr", "current", 1e-3},
+    {"power", "power", 1e-6},      {"energy", "energy", 1e-6},
+    {"humidity", "humidity", 1e-3}};
+
+/**
+ * @brief Find the kind of the hwmon attribute, like temp1_input
+ */
+static const HwmonKind* hwmonKind(std::string_view attr)
+{
+    const size_t pos = attr.find_first_of("0123456789");
+    if (pos == std::string_view::npos)
+    {
+        return nullptr;
+    }
+    for (const auto& kind : HWMON_KINDS)
+    {
+        if (attr.substr(0, pos) == kind.prefix)
+        {
+            return &kind;
+        }
+    }
+    return nullptr;
+}
+
+HwmonReader::HwmonReader(const std::string& root) : root(root) {}
+
+HwmonReader::~HwmonReader()
+{
+    for (const auto& attr : attributes)
+    {
+        close(attr.fd);
+    }
+}
+
+size_t HwmonReader::map(const Samples& samples, const char* config)
+{
+    // Attribute file by the sensor name or path
+    std::map<std::string, std::string, std::less<>> files;
+    if (config)
+    {
+        std::ifstream in(config);
+        if (!in)
+        {
+            throw std::runtime_error(std::string("Can't read ") + config);
+        }
+        std::string line;
+        while (std::getline(in, line))
+        {
+            line.erase(std::min(line.find('#'), line.size()));
+            const size_t name = line.find_first_not_of(" \t");
+            if (name == std::string::npos)
+            {
+                continue;
+            }
+            const size_t sep = line.find_first_of(" \t", name);
+            const size_t path = line.find_first_not_of(" \t", sep);
+            if (path == std::string::npos)
+            {
+                throw std::runtime_error("Invalid line in " +
+                                         std::string(config) + ": " + line);
+            }
+            const size_t end = line.find_last_not_of(" \t") + 1;
+            files[line.substr(name, sep - name)] =
+                root + '/' + line.substr(path, end - path);
+        }
+    }
+    else if (DIR* dir = opendir(root.c_str()))
+    {
+        // Map the labels to the input attributes
+        while (const dirent* chip = readdir(dir))
+        {
+            if (chip->d_name[0] == '.')
+            {
+                continue;
+            }
+            const std::string chip_path = root + '/' + chip->d_name;
+            DIR* attrs = opendir(chip_path.c_str());
+            if (!attrs)
+            {
+                continue;
+            }
+            while (const dirent* attr = readdir(attrs))
+            {
+                std::string_view name(attr->d_name);
+                constexpr std::string_view suffix = "_label";
+                if (name.size() <= suffix.size() ||
+                    name.substr(name.size() - suffix.size()) != suffix ||
+                    !hwmonKind(name))
+                {
+                    continue;
+                }
+                std::ifstream in(chip_path + '/' + attr->d_name);
+                std::string label;
+                if (!std::getline(in, label) || label.empty())
+                {
+                    continue;
+                }
+                // D-Bus object names can't have spaces
+                std::replace(label.begin(), label.end(), ' ', '_');
+                const std::string input =
+                    chip_path + '/' +
+                    std::string(name.substr(0, name.size() - suffix.size())) +
+                    "_input";
+                // Same label of the different kinds is told apart by type
+                const std::string type = hwmonKind(name)->type;
+                files.emplace(type + '/' + label, input);
+            }
+            closedir(attrs);
+        }
+        closedir(dir);
+    }
+
+    for (const auto& attr : attributes)
+    {
+        close(attr.fd);
+    }
+    attributes.clear();
+    mask.assign(samples.size(), false);
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        const std::string& path = samples[i].path;
+        const size_t name_pos = path.rfind('/');
+        const size_t folder_pos = path.rfind('/', name_pos - 1);
+        auto it = files.find(path);
+        if (it == files.end())
+        {
+            it = files.find(std::string_view(path).substr(
+                config ? name_pos + 1 : folder_pos + 1));
+        }
+        if (it == files.end())
+        {
+            continue;
+        }
+
+        const std::string& file = it->second;
+        const HwmonKind* kind =
+            hwmonKind(std::string_view(file).substr(file.rfind('/') + 1));
+        if (!kind)
+        {
+            continue;
+        }
+        const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        const Properties& props = samples[i].props;
+        auto value = props.find("Value");
+        const bool integer = value != props.end() &&
+                             std::holds_alternative<int64_t>(value->second);
+        double factor = kind->factor;
+        if (integer)
+        {
+            // The sensor reports the value multiplied by 10^-Scale
+            factor /= props.scale();
+        }
+        attributes.push_back({i, fd, factor, integer});
+        mask[i] = true;
+    }
+    return attributes.size();
+}
+
+/**
+ * @brief Derive the threshold alarms from the value read from hwmon
+ *
+ * The alarms fetched from the bus are as old as the last sweep, while the
+ * thresholds are static, so they are compared with the fresh value the same
+ * way the sensor service does it, without the hysteresis.
+ */
+static void updateAlarms(Properties& props)
+{
+    static constexpr std::tuple<const char*, const char*, bool> alarms[] = {
+        {"WarningHigh", "WarningAlarmHigh", true},
+        {"WarningLow", "WarningAlarmLow", false},
+        {"CriticalHigh", "CriticalAlarmHigh", true},
+        {"CriticalLow", "CriticalAlarmLow", false},
+        {"FatalHigh", "FatalAlarmHigh", true}};
+
+    const auto value = props.number("Value");
+    if (!value)
+    {
+        // Nothing to compare, the alarms of the bus are kept
+        return;
+    }
+    for (const auto& [threshold, alarm, high] : alarms)
+    {
+        if (const auto limit = props.number(threshold))
+        {
+            props.insert_or_assign(
+                alarm, PropertyValue(high ? *value >= *limit
+                                          : *value <= *limit));
+        }
+    }
+}
+
+void HwmonReader::read(Samples& samples)
+{
+    char buf[32];
+    for (const auto& attr : attributes)
+    {
+        Properties& props = samples[attr.index].props;
+        const ssize_t len = pread(attr.fd, buf, sizeof(buf) - 1, 0);
+        char* end = buf;
+        long long raw = 0;
+        if (len > 0)
+        {
+            buf[len] = '\0';
+            raw = strtoll(buf, &end, 10);
+        }
+        if (end == buf)
+        {
+            // The attribute can't be read now, e.g. the fan is stopped
+            props.insert_or_assign("Value", PropertyValue(NAN));
+        }
+        else if (attr.integer)
+        {
+            props.insert_or_assign(
+                "Value", PropertyValue(static_cast<int64_t>(
+                             std::llround(raw * attr.factor))));
+        }
+        else
+        {
+            props.insert_or_assign("Value", PropertyValue(raw * attr.factor));
+        }
+        updateAlarms(props);
+    }
+}
+
+std::vector<TypeSummary> summarize(const Samples& samples)
+{
+    std::vector<TypeSummary> ret;
+    for (const auto& sample : samples)
+    {
+        const std::string& path = sample.path;
+        const size_t name_pos = path.rfind('/');
+        const size_t folder_pos = path.rfind('/', name_pos - 1);
+        const std::string_view type(path.c_str() + folder_pos + 1,
+                                    name_pos - folder_pos - 1);
+
+        // The sensors are usually grouped by type, check the last one first
+        auto it = ret.rbegin();
+        while (it != ret.rend() && it->type != type)
+        {
+            ++it;
+        }
+        if (it == ret.rend())
+        {
+            ret.emplace_back();
+            ret.back().type = type;
+            it = ret.rbegin();
+        }
+        TypeSummary& sum = *it;
+
+        const Properties& props = sample.props;
+        const Status state = props.empty() ? Status::unavailable
+                                           : props.state();
+        ++sum.count;
+        ++sum.states[static_cast<size_t>(state)];
+        if (sum.unit.empty())
+        {
+            sum.unit = props.unit();
+            sum.unit.erase(sum.unit.find_last_not_of(' ') + 1);
+        }
+        if (const auto value = props.reading())
+        {
+            if (!sum.readings)
+            {
+                sum.min = sum.max = *value;
+            }
+            sum.min = std::min(sum.min, *value);
+            sum.max = std::max(sum.max, *value);
+            sum.sum += *value;
+            ++sum.readings;
+        }
+    }
+    return ret;
+}
+
+StatusTracker::StatusTracker(size_t count, const Debounce& debounce) :
+    debounce(debounce), states(count, {UNKNOWN, UNKNOWN, 0, 0})
+{}
+
+std::optional<Status> StatusTracker::update(size_t index, Status state,
+                                            uint64_t now)
+{
+    State& rec = states[index];
+    const auto current = static_cast<uint8_t>(state);
+    if (rec.stable == UNKNOWN || current == rec.stable)
+    {
+        rec.stable = current;
+        rec.pending = current;
+        rec.seen = 0;
+        return std::nullopt;
+    }
+
+    if (current != rec.pending)
+    {
+        rec.pending = current;
+        rec.seen = 0;
+        rec.since = now;
+    }
+    if (rec.seen < UINT16_MAX)
+    {
+        ++rec.seen;
+    }
+    if (rec.seen < debounce.samples || now - rec.since < debounce.dwell)
+    {
+        return std::nullopt;
+    }
+
+    const auto prev = static_cast<Status>(rec.stable);
+    rec.stable = current;
+    rec.seen = 0;
+    return prev;
+}
+
+AnomalyDetector::AnomalyDetector(size_t count, double threshold,
+                                 unsigned window) :
+    alpha(2.0 / (window + 1)), threshold(threshold), warmup(window),
+    states(count, {0, 0, 0})
+{}
+
+std::optional<double> AnomalyDetector::update(size_t index, double value)
+{
+    State& rec = states[index];
+    if (!rec.count++)
+    {
+        rec.mean = value;
+        return std::nullopt;
+    }
+
+    const double diff = value - rec.mean;
+    std::optional<double> ret;
+    if (rec.count > warmup && rec.variance > 0)
+    {
+        const double score = diff / std::sqrt(rec.variance);
+        if (std::fabs(score) >= threshold)
+        {
+            ret = score;
+        }
+    }
+
+    const double incr = alpha * diff;
+    rec.mean += incr;
+    rec.variance = (1 - alpha) * (rec.variance + diff * incr);
+    if (rec.count == UINT32_MAX)
+    {
+        rec.count = warmup + 1;
+    }
+    return ret;
+}
+
+TrendPredictor::TrendPredictor(size_t count, unsigned window) :
+    window(window), states(count, {0, 0, 0, 0, 0, 0, 0}),
+    times(count * window), values(count * window)
+{}
+
+void TrendPredictor::update(size_t index, double time, double value)
+{
+    State& rec = states[index];
+    double* t = &times[index * window];
+    double* v = &values[index * window];
+
+    if (rec.size == 0)
+    {
+        rec.origin = time;
+    }
+    // The sums of the absolute times would lose the slope to cancellation
+    time -= rec.origin;
+    if (rec.size == window)
+    {
+        rec.sx -= t[rec.head];
+        rec.sy -= v[rec.head];
+        rec.sxx -= t[rec.head] * t[rec.head];
+        rec.sxy -= t[rec.head] * v[rec.head];
+    }
+    else
+    {
+        ++rec.size;
+    }
+    t[rec.head] = time;
+    v[rec.head] = value;
+    rec.head = (rec.head + 1) % window;
+
+    if (rec.head == 0 && rec.size == window)
+    {
+        // Move the origin to the oldest value to keep the times small
+        const double shift = t[0];
+        rec.origin += shift;
+        rec.sx = rec.sy = rec.sxx = rec.sxy = 0;
+        for (unsigned i = 0; i < window; ++i)
+        {
+            t[i] -= shift;
+            rec.sx += t[i];
+            rec.sy += v[i];
+            rec.sxx += t[i] * t[i];
+            rec.sxy += t[i] * v[i];
+        }
+    }
+    else
+    {
+        rec.sx += time;
+        rec.sy += value;
+        rec.sxx += time * time;
+        rec.sxy += time * value;
+    }
+}
+
+std::optional<TrendPredictor::Prediction>
+    TrendPredictor::predict(size_t index, double time,
+                            const Properties& props) const
+{
+    const State& rec = states[index];
+    if (rec.size < 3)
+    {
+        return std::nullopt;
+    }
+    const double n = rec.size;
+    const double denom = n * rec.sxx - rec.sx * rec.sx;
+    if (!(denom > 0))
+    {
+        return std::nullopt;
+    }
+    const double slope = (n * rec.sxy - rec.sx * rec.sy) / denom;
+    const double current =
+        (rec.sy - slope * rec.sx) / n + slope * (time - rec.origin);
+    if (slope == 0 || !std::isfinite(current))
+    {
+        return std::nullopt;
+    }
+
+    static constexpr std::pair<const char*, const char*> upper[] = {
+        {"UNC", "WarningHigh"}, {"UC", "CriticalHigh"}, {"NR", "FatalHigh"}};
+    static constexpr std::pair<const char*, const char*> lower[] = {
+        {"LNC", "WarningLow"}, {"LC", "CriticalLow"}};
+
+    std::optional<Prediction> ret;
+    auto check = [&](const auto& thresholds) {
+        for (const auto& [title, name] : thresholds)
+        {
+            const auto limit = props.number(name);
+            if (!limit)
+            {
+                continue;
+            }
+            const double eta = (*limit - current) / slope;
+            if (eta > 0 && (!ret || eta < ret->eta))
+            {
+                ret = Prediction{eta, title, *limit};
+            }
+        }
+    };
+    if (slope > 0)
+    {
+        check(upper);
+    }
+    else
+    {
+        check(lower);
+    }
+    return ret;
+}
+
+/**
+ * @brief Mapper call state of the speculative discovery
+ */
+struct MapperCall
+{
+    sd_bus_message* reply = nullptr;
+    bool done = false;
+
+    ~MapperCall()
+    {
+        sd_bus_message_unref(reply);
+    }
+
+    static int onReply(sd_bus_message* m, void* userdata, sd_bus_error*)
+    {
+        auto call = static_cast<MapperCall*>(userdata);
+        call->done = true;
+        if (!sd_bus_message_is_method_error(m, nullptr))
+        {
+            call->reply = sd_bus_message_ref(m);
+        }
+        return 0;
+    }
+};
+
+Samples discoverPrefetch(const std::string& root_path, Topology& topology,
+                         Samples expected, Fetcher& fetcher,
+                         std::vector<bool>& fetched, uint64_t timeout,
+                         const std::vector<Interfaces>& dynamic)
+{
+    auto method = bus().new_method_call(MAPPER_SERVICE, MAPPER_PATH,
+                                            MAPPER_IFACE, "GetSubTree");
+    const std::vector<std::string> ifaces = {SENSOR_VALUE_IFACE};
+    method.append(root_path, 0, ifaces);
+
+    MapperCall call;
+    sd_bus_slot* slot = nullptr;
+    const int rc = sd_bus_call_async(bus().get_bus(), &slot, method.get(),
+                                     MapperCall::onReply, &call, timeout);
+    if (rc < 0)
+    {
+        throw sdbusplus::exception::SdBusError(-rc, "sd_bus_call_async");
+    }
+    std::unique_ptr<sd_bus_slot, decltype(&sd_bus_slot_unref)> guard(
+        slot, sd_bus_slot_unref);
+
+    // The mapper reply is dispatched while the fetcher processes the bus
+    fetcher.fetch(expected, {}, dynamic);
+    while (!call.done)
+    {
+        const int rc = sd_bus_process(bus().get_bus(), nullptr);
+        if (rc < 0)
+        {
+            throw sdbusplus::exception::SdBusError(-rc, "sd_bus_process");
+        }
+        if (rc == 0)
+        {
+            sd_bus_wait(bus().get_bus(), UINT64_MAX);
+        }
+    }
+
+    if (!call.reply)
+    {
+        // Repeat the call to report the mapper error as discover() does
+        discover(root_path, topology, timeout);
+    }
+    else
+    {
+        topology.objects.clear();
+        topology.inventory.clear();
+        sdbusplus::message::message(call.reply).read(topology.objects);
+    }
+
+    // Keep the results of the sensors still in place
+    std::map<std::pair<std::string_view, std::string_view>, size_t> index;
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        if (!fetcher.failed(i) && !fetcher.timedOut(i))
+        {
+            index.emplace(std::make_pair(std::string_view(expected[i].path),
+                                         std::string_view(expected[i].service)),
+                          i);
+        }
+    }
+    Samples samples = makeSamples(topology);
+    fetched.assign(samples.size(), false);
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        auto it = index.find(std::make_pair(
+            std::string_view(samples[i].path),
+            std::string_view(samples[i].service)));
+        if (it != index.end())
+        {
+            samples[i].props = std::move(expected[it->second].props);
+            fetched[i] = true;
+        }
+    }
+    return samples;
+}
+
+Samples snapshot(const std::string& type)
+{
+    Topology topology;
+    discover(sensorsPath(type), topology);
+
+    Samples samples = makeSamples(topology);
+    const Fetcher::Limits limits;
+    const FetchPriority priority;
+    Fetcher fetcher(limits, priority);
+    fetcher.fetch(samples);
+
+    // Drop the sensors failed to fetch
+    size_t fetched = 0;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        if (!fetcher.failed(i))
+        {
+            if (fetched != i)
+            {
+                samples[fetched] = std::move(samples[i]);
+            }
+            ++fetched;
+        }
+    }
+    samples.resize(fetched);
+    return samples;
+}
+
+bool watch(Samples& samples, Fetcher& fetcher, double interval,
+           const WatchCallback& callback,
+           const std::function<bool()>& cancelled)
+{
+    const uint64_t period = static_cast<uint64_t>(interval * 1000000);
+    uint64_t next = monotonicUsec();
+    while (true)
+    {
+        try
+        {
+            fetcher.fetch(samples);
+            for (size_t i = 0; i < samples.size(); ++i)
+            {
+                if (fetcher.failed(i) && !fetcher.timedOut(i))
+                {
+                    revalidateSample(samples[i]);
+                }
+            }
+        }
+        catch (const sdbusplus::exception::SdBusError& ex)
+        {
+            if (!isConnectionLost(ex))
+            {
+                throw;
+            }
+            if (!reconnect(cancelled))
+            {
+                return false;
+            }
+            next = monotonicUsec();
+            continue;
+        }
+
+        if (!callback(samples))
+        {
+            return true;
+        }
+
+        // Skip the ticks missed while fetching
+        const uint64_t now = monotonicUsec();
+        next += period;
+        if (next < now)
+        {
+            next = now + period - (now - next) % period;
+        }
+        const struct timespec ts = {
+            static_cast<time_t>(next / 1000000),
+            static_cast<long>(next % 1000000 * 1000),
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+               EINTR)
+        {
+        }
+    }
+}
+
+} // namespace lssensors
@@ -0,0 +1,144 @@
+/**
+ * @brief C interface of the sensors library.
+ *
+ * Functions returning int report failures as negative errno.
+ * The library is not thread-safe.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Set of the discovered sensors
+ */
+typedef struct lssensors_set lssensors_t;
+
+// Bus connection of libsystemd
+struct sd_bus;
+
+/**
+ * @brief Sensor state
+ */
+enum lssensors_status
+{
+    LSSENSORS_OK,
+    LSSENSORS_WARNING,
+    LSSENSORS_CRITICAL,
+    LSSENSORS_FATAL,
+    // Sensor is not functional
+    LSSENSORS_FAILED,
+    // Sensor is not available or has not answered
+    LSSENSORS_UNAVAILABLE,
+};
+
+/**
+ * @brief Sensor reading, the strings are valid until the next update
+ */
+struct lssensors_reading
+{
+    // Sensor object path
+    const char* path;
+    // Sensor name, the last component of the path
+    const char* name;
+    // Short unit name
+    const char* unit;
+    // Current value, NAN if not available
+    double value;
+    // Thresholds, NAN if not set
+    double critical_low;
+    double warning_low;
+    double warning_high;
+    double critical_high;
+    // Current state
+    enum lssensors_status status;
+};
+
+/**
+ * @brief Watch callback
+ *
+ * @param sensors - Sensors updated on the current tick
+ * @param data    - User data
+ *
+ * @return non-zero to stop watching
+ */
+typedef int (*lssensors_callback)(const lssensors_t* sensors, void* data);
+
+/**
+ * @brief Watch cancellation check
+ *
+ * @param data - User data
+ *
+ * @return non-zero to stop restoring the lost bus connection
+ */
+typedef int (*lssensors_cancel)(void* data);
+
+/**
+ * @brief Use the caller's bus connection instead of the system bus
+ *
+ * Without it the system bus is opened on the first use.
+ *
+ * @param bus - Open bus connection, referenced by the library
+ */
+void lssensors_use_bus(struct sd_bus* bus);
+
+/**
+ * @brief Discover the sensors
+ *
+ * @param type - Sensors type (like "temperature"), NULL for all sensors
+ *
+ * @return sensors set or NULL with errno set on failure
+ */
+lssensors_t* lssensors_open(const char* type);
+
+/**
+ * @brief Release the sensors set
+ */
+void lssensors_close(lssensors_t* sensors);
+
+/**
+ * @brief Fetch the current readings of all sensors
+ */
+int lssensors_update(lssensors_t* sensors);
+
+/**
+ * @brief Get the number of sensors in the set
+ */
+size_t lssensors_count(const lssensors_t* sensors);
+
+/**
+ * @brief Get the sensor reading from the last update
+ *
+ * @param sensors - Sensors set
+ * @param index   - Sensor index, the sensors are in natural path order
+ * @param reading - Reading to fill in
+ */
+int lssensors_get(const lssensors_t* sensors, size_t index,
+                  struct lssensors_reading* reading);
+
+/**
+ * @brief Update the sensors periodically until the callback asks to stop
+ *
+ * The lost bus connection is restored meanwhile, retrying until the bus
+ * responds or the cancellation check asks to stop.
+ *
+ * @param sensors  - Sensors set
+ * @param interval - Interval between updates, seconds
+ * @param callback - Called after every update
+ * @param cancel   - Called between the reconnection attempts, NULL to retry
+ *                   for as long as it takes
+ * @param data     - User data for the callbacks
+ *
+ * @return -ECANCELED if cancelled while the bus connection was lost
+ */
+int lssensors_watch(lssensors_t* sensors, double interval,
+                    lssensors_callback callback, lssensors_cancel cancel,
+                    void* data);
+
+#ifdef __cplusplus
+}
+#endif
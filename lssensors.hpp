@@ -0,0 +1,625 @@
+/**
+ * @brief Sensors library: discovery, fetching and evaluation of the
+ *        OpenBMC sensors.
+ *
+ * All calls use the library's bus connection, which is opened to the local
+ * system bus by default. The library is not thread-safe.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/exception.hpp>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace lssensors
+{
+
+// Names and string values are borrowed from the storage of Properties
+using PropertyValue = std::variant<int64_t, std::string_view, bool, double>;
+using PropertyName = std::string_view;
+using PropertiesMap = std::map<PropertyName, PropertyValue, std::less<>>;
+
+static constexpr auto SYSTEMD_PROPERTIES = "org.freedesktop.DBus.Properties";
+
+/**
+ * @brief Get the bus connection used by the library
+ *
+ * The default bus is opened on the first use unless the connection is set
+ * with useBus() or connectBus().
+ */
+sdbusplus::bus::bus& bus();
+
+/**
+ * @brief Use the caller's bus connection
+ *
+ * @param conn - Open bus connection, referenced by the library
+ */
+void useBus(sd_bus* conn);
+
+/**
+ * @brief Open the connection to the system bus
+ *
+ * @param host - Remote host to connect to over ssh, if the remote host
+ *               support is enabled, or nullptr for the local bus
+ *
+ * @return negative errno on failure
+ */
+int connectBus(const char* host = nullptr);
+
+/**
+ * @brief Check if the error is caused by the broken bus connection
+ */
+bool isConnectionLost(const sdbusplus::exception::SdBusError& ex);
+
+// Reconnection backoff limits, microseconds
+static constexpr useconds_t RECONNECT_MIN_DELAY = 10000;
+static constexpr useconds_t RECONNECT_MAX_DELAY = 5000000;
+
+/**
+ * @brief Reopen the bus connection once
+ *
+ * @return true if the bus responds
+ */
+bool tryReconnect();
+
+/**
+ * @brief Reopen the bus connection, retrying with exponential backoff until
+ *        the bus responds.
+ *
+ * Nothing is reported meanwhile, the caller tells the user if needed.
+ *
+ * @param cancelled - Checked between the attempts, the reconnecting is
+ *                    given up as soon as it returns true
+ *
+ * @return false if cancelled
+ */
+bool reconnect(const std::function<bool()>& cancelled = nullptr);
+
+/**
+ * @brief Sensor state
+ */
+enum class Status
+{
+    ok,
+    warning,
+    critical,
+    fatal,
+    // Sensor is not functional
+    failed,
+    // Sensor is not available
+    unavailable,
+};
+
+// Number of the sensor states
+static constexpr size_t STATUS_COUNT =
+    static_cast<size_t>(Status::unavailable) + 1;
+
+/**
+ * @brief Get the state name
+ */
+const char* statusName(Status status);
+
+/**
+ * @brief Gives a simple access to sensor properties.
+ *
+ * The property names and string values point either into the D-Bus reply
+ * they were decoded from or into the owned strings storage. Both are shared
+ * between the copies, so a copy stays valid after the original is gone.
+ */
+class Properties : public PropertiesMap
+{
+  public:
+    using PropertiesMap::PropertiesMap;
+
+    /**
+     * @brief Keep the message the names and values are borrowed from
+     *
+     * @param m - D-Bus message
+     */
+    void borrow(sd_bus_message* m);
+
+    /**
+     * @brief Store the string not backed by a message
+     *
+     * @param str - String to store
+     *
+     * @return view of the stored string
+     */
+    std::string_view keep(std::string&& str);
+
+    /**
+     * @brief Check if sensor Available and Functional
+     */
+    std::string functional() const;
+
+    /**
+     * @brief Current sensor state
+     */
+    Status state() const;
+
+    /**
+     * @brief Current sensor state name
+     */
+    std::string status() const;
+
+    /**
+     * @brief Sensor's scale factor
+     */
+    float scale() const;
+
+    std::string value() const;
+    std::string criticalLow() const;
+    std::string criticalHigh() const;
+    std::string warningLow() const;
+    std::string warningHigh() const;
+    std::string fatalHigh() const;
+
+    /**
+     * @brief Short sensors unit name
+     */
+    std::string unit() const;
+
+    /**
+     * @brief Numeric value of the property with the scale factor applied
+     *
+     * @param name - Property name
+     *
+     * @return value or nothing if the property is missing or not a number
+     */
+    std::optional<double> number(const PropertyName& name) const;
+
+    /**
+     * @brief Current sensor reading, if the sensor is functional
+     */
+    std::optional<double> reading() const;
+
+  protected:
+    /**
+     * @brief Check is the specified boolean property has true value
+     *
+     * @param name - Property name
+     */
+    bool getBool(const PropertyName& name) const;
+
+    /**
+     * @brief Format a sensor value or threshold
+     *
+     * @param name - Property name
+     *
+     * @return String with formatted value of property
+     */
+    std::string getValue(const PropertyName& name) const;
+
+  private:
+    // Reply message the properties are borrowed from
+    std::shared_ptr<sd_bus_message> reply;
+    // Strings the properties are borrowed from, if not from a message
+    std::shared_ptr<std::deque<std::string>> strings;
+};
+
+/**
+ * @brief Sensor's properties snapshot taken from a single object
+ */
+struct Sample
+{
+    std::string path;
+    std::string service;
+    Properties props;
+    // Inventory item the sensor belongs to, if resolved
+    std::string inventory;
+};
+
+using Samples = std::vector<Sample>;
+
+/**
+ * @brief Decode the GetAll reply into the properties.
+ *
+ * Names and string values are not copied, they point into the message
+ * memory and the message is kept referenced by the properties. The existing
+ * map entries are moved over to the new names, so decoding the same sensor
+ * repeatedly does not allocate anything. Properties of the types not
+ * represented in PropertyValue are skipped.
+ *
+ * @param m     - GetAll reply message
+ * @param props - Properties storage
+ *
+ * @return negative errno on malformed message
+ */
+int decodeProperties(sd_bus_message* m, Properties& props);
+
+/**
+ * @brief Ask DBus for all properties of the sensor
+ *
+ * @param service - Sensor's object service
+ * @param path    - Sensor's object path
+ * @param props   - Properties storage
+ *
+ * @return negative errno on failure
+ */
+int getProperties(const std::string& service, const std::string& path,
+                  Properties& props);
+
+/**
+ * @brief Ask the mapper which service currently provides the sensor
+ *
+ * @param path - Sensor's object path
+ *
+ * @return service name or empty string if the sensor has gone
+ */
+std::string resolveService(const std::string& path);
+
+/**
+ * @brief Revalidate the cached service of the sensor and get its properties.
+ *
+ * The sensors table is resolved once, but the providing service may be
+ * restarted or replaced. If the cached service does not answer for the
+ * object, the mapper is asked for the actual one and the request is repeated.
+ * If the sensor is not available at all, it is left without properties.
+ *
+ * @param sample - Sensor's snapshot with the cached service name
+ *
+ * @return negative errno on unrecoverable error
+ *
+ * @throw SdBusError if the bus connection is lost
+ */
+int revalidateSample(Sample& sample);
+
+/**
+ * @brief Get current monotonic time in microseconds
+ */
+uint64_t monotonicUsec();
+
+/**
+ * @brief compare sensors path with numbers
+ */
+struct CmpSensorsName
+{
+    bool operator()(const std::string& a, const std::string& b) const;
+};
+
+using Path = std::string;
+using Service = std::string;
+using Interface = std::string;
+using Interfaces = std::vector<Interface>;
+using ObjectsMap = std::map<Service, Interfaces>;
+using Objects = std::map<Path, ObjectsMap, CmpSensorsName>;
+
+/**
+ * @brief Discovered sensors and their relations
+ */
+struct Topology
+{
+    // Sensors objects
+    Objects objects;
+    // Sensor path to its inventory item path
+    std::map<Path, Path> inventory;
+};
+
+/**
+ * @brief Get the sensors root path
+ *
+ * @param type - Sensors type (like "temperature"), empty for all sensors
+ */
+std::string sensorsPath(const std::string& type = std::string());
+
+/**
+ * @brief Discover the sensors with the mapper
+ *
+ * @param root_path - Sensors root path
+ * @param topology  - Discovered sensors
+ * @param timeout   - Mapper call timeout, us (0 - bus default)
+ *
+ * @throw SdBusError on failure, FileNotFound if there are no sensors
+ */
+void discover(const std::string& root_path, Topology& topology,
+              uint64_t timeout = 0);
+
+/**
+ * @brief Discover the sensors without the mapper, values included.
+ *
+ * The services on the bus are asked for all their objects with
+ * GetManagedObjects concurrently, at the root object manager or at the
+ * sensors root one. The sensors come with all their properties, just like
+ * after fetching them. A service is asked one call at a time, so the calls
+ * are not limited like the fetcher's ones.
+ *
+ * @param root_path - Sensors root path
+ * @param services  - Service names or shell wildcards to ask, all if empty
+ * @param topology  - Discovered sensors
+ * @param samples   - Discovered sensors with properties, in natural order
+ * @param timeout   - Timeout of every service call, us (0 - bus default)
+ *
+ * @return number of the services failed to answer
+ *
+ * @throw SdBusError on bus failure
+ */
+size_t discoverManaged(const std::string& root_path,
+                       const std::vector<std::string>& services,
+                       Topology& topology, Samples& samples,
+                       uint64_t timeout = 0);
+
+/**
+ * @brief Resolve the unique names of the sensors services owners.
+ *
+ * All the owners not known yet are asked at once, so the whole lookup takes
+ * a single round trip.
+ *
+ * @param samples - Sensors of the services to resolve
+ * @param owners  - Unique names by service, the failed ones are not added
+ */
+void resolveOwners(const Samples& samples,
+                   std::map<Service, std::string>& owners);
+
+/**
+ * @brief Resolve inventory items of all sensors with a single call.
+ *
+ * The mapper hosts the association objects (like SENSOR/inventory or
+ * SENSOR/chassis) under its object manager, so all the association endpoints
+ * are received at once, regardless of the sensors count. The properties of
+ * unexpected types are skipped. Without the object manager the endpoints of
+ * every sensor are asked, all the calls at once.
+ *
+ * @param topology - Discovered sensors, the inventory map is filled in
+ *
+ * @return false if the associations can't be received
+ */
+bool resolveInventory(Topology& topology);
+
+/**
+ * @brief Build the samples of all discovered sensors, one per service
+ *
+ * @param topology - Discovered sensors
+ */
+Samples makeSamples(const Topology& topology);
+
+/**
+ * @brief Order of fetching the sensors within a sweep.
+ *
+ * The sensors are ranked by the list of criteria, the first criterion is the
+ * most significant one. Sensors of the same rank are fetched in path order.
+ */
+class FetchPriority
+{
+  public:
+    enum class Criterion
+    {
+        // Sensors tagged by the user go first
+        tag,
+        // Sensors in Fatal, Critical, Warning state on previous sweep first
+        status,
+        // Temperature and power sensors before others
+        type,
+    };
+
+    FetchPriority();
+
+    /**
+     * @brief Set the criteria from the comma-separated list
+     *
+     * @param list - Criteria names or "none"
+     *
+     * @return false if the list contains unknown criterion
+     */
+    bool setCriteria(const std::string& list);
+
+    /**
+     * @brief Add the user tag, sensor name or shell wildcard
+     */
+    void addTag(const std::string& tag);
+
+    /**
+     * @brief Get the sensor's rank, lower is fetched earlier
+     *
+     * @param sample - Sensor with properties from the previous sweep, if any
+     */
+    unsigned rank(const Sample& sample) const;
+
+  private:
+    unsigned tagRank(const char* name) const;
+
+    static unsigned statusRank(const Properties& props);
+
+    static unsigned typeRank(const std::string& path, size_t name_pos);
+
+    std::vector<Criterion> criteria;
+    std::vector<std::string> tags;
+};
+
+/**
+ * @brief Concurrent sensors properties fetcher with the load limiter.
+ *
+ * All requests of the sweep are issued asynchronously, but the admission is
+ * controlled to keep the sensor daemons responsive for other clients:
+ *  - the global request rate is limited by the token bucket;
+ *  - the number of outstanding requests is limited per service. The limit
+ *    adapts to the observed reply latency in the AIMD way: it grows by one
+ *    per round trip while the latency stays close to the best one observed
+ *    for the service, and it is halved when the latency rises.
+ *
+ * The queued requests are admitted in the order of FetchPriority, so under
+ * the sweep timeout the most important sensors are fetched first.
+ */
+class Fetcher
+{
+  public:
+    // Limiter settings, tunable by the front end only
+    struct Limits;
+
+    /**
+     * @brief Constructor of the fetcher with the default limits
+     *
+     * @param priority - Order of fetching the sensors within a sweep
+     */
+    explicit Fetcher(const FetchPriority& priority = FetchPriority());
+    Fetcher(const Limits& limits, const FetchPriority& priority);
+    ~Fetcher();
+
+    Fetcher(const Fetcher&) = delete;
+    Fetcher& operator=(const Fetcher&) = delete;
+
+    /**
+     * @brief Fetch properties of all samples concurrently
+     *
+     * @param samples - Sensors to fetch, properties of the previous sweep are
+     *                  used for ranking and then updated in place
+     * @param skip    - Samples not to fetch, e.g. read from hwmon, by index
+     * @param dynamic - Interfaces to get the properties of, by index; all
+     *                  properties are got for the samples without exactly
+     *                  one, so each sample takes a single call
+     *
+     * @throw SdBusError if the bus connection is lost
+     */
+    void fetch(Samples& samples, const std::vector<bool>& skip = {},
+               const std::vector<Interfaces>& dynamic = {});
+
+    /**
+     * @brief Get the sweep timeout, milliseconds (0 - unlimited)
+     */
+    unsigned timeout() const;
+
+    /**
+     * @brief Change the sweep timeout of the next sweeps
+     *
+     * @param timeout - Sweep timeout, milliseconds (0 - unlimited)
+     */
+    void setTimeout(unsigned timeout);
+
+    /**
+     * @brief Check if fetching of the sample with specified index failed
+     */
+    bool failed(size_t index) const;
+
+    /**
+     * @brief Check if the sample with specified index was not fetched in time
+     */
+    bool timedOut(size_t index) const;
+
+    /**
+     * @brief Get the number of the bus waits, i.e. process wakeups
+     */
+    size_t wakeups() const;
+
+    /**
+     * @brief Print the limiter statistics
+     */
+    void printStats(FILE* out) const;
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+/**
+ * @brief Discover the sensors with the mapper, fetching the expected ones
+ * meanwhile.
+ *
+ * The expected sensors, e.g. remembered from the previous run, are fetched
+ * while the mapper call is in flight. The results for the sensors still
+ * present are kept, the vanished sensors are dropped.
+ *
+ * @param root_path - Sensors root path
+ * @param topology  - Discovered sensors
+ * @param expected  - Sensors expected to be discovered
+ * @param fetcher   - Fetcher for the expected sensors
+ * @param fetched   - Mask of the returned samples already fetched
+ * @param timeout   - Mapper call timeout, us (0 - bus default)
+ * @param dynamic   - Interfaces to get the properties of, by expected
+ *                    sensor index, see Fetcher::fetch
+ *
+ * @return samples of the discovered sensors, the same as makeSamples gives
+ *
+ * @throw SdBusError on failure, FileNotFound if there are no sensors
+ */
+Samples discoverPrefetch(const std::string& root_path, Topology& topology,
+                         Samples expected, Fetcher& fetcher,
+                         std::vector<bool>& fetched, uint64_t timeout = 0,
+                         const std::vector<Interfaces>& dynamic = {});
+
+/**
+ * @brief Aggregated readings of the sensors of the same type
+ */
+struct TypeSummary
+{
+    // Sensors type, the folder name
+    std::string type;
+    // Unit of the first sensor, without the alignment spaces
+    std::string unit;
+    // Number of sensors
+    size_t count = 0;
+    // Number of sensors with the valid reading
+    size_t readings = 0;
+    double min = 0;
+    double max = 0;
+    double sum = 0;
+    // Number of sensors in each state, indexed by Status
+    size_t states[STATUS_COUNT] = {};
+};
+
+/**
+ * @brief Aggregate the sensors per type in a single pass
+ *
+ * @param samples - Sensors, the ones failed to fetch without properties
+ *
+ * @return summaries in the order of the first sensor of each type
+ */
+std::vector<TypeSummary> summarize(const Samples& samples);
+
+/**
+ * @brief Take the snapshot of all sensors of the type
+ *
+ * The sensors failed to answer are not included.
+ *
+ * @param type - Sensors type (like "temperature"), empty for all sensors
+ *
+ * @return sensors in the natural order of their paths
+ *
+ * @throw SdBusError on failure
+ */
+Samples snapshot(const std::string& type = std::string());
+
+/**
+ * @brief Watch callback
+ *
+ * @param samples - Sensors fetched on the current tick, the failed ones have
+ *                  no properties
+ *
+ * @return false to stop watching
+ */
+using WatchCallback = std::function<bool(const Samples& samples)>;
+
+/**
+ * @brief Fetch the sensors periodically and pass them to the callback.
+ *
+ * The ticks follow the absolute schedule. The lost bus connection is restored
+ * and the sensors whose service has changed are revalidated transparently.
+ *
+ * @param samples   - Sensors to watch
+ * @param fetcher   - Sensors properties fetcher
+ * @param interval  - Interval between ticks, seconds
+ * @param callback  - Receiver of the samples
+ * @param cancelled - Checked between the attempts to restore the lost bus
+ *                    connection, watching stops as soon as it returns true;
+ *                    without it the attempts never stop, see reconnect()
+ *
+ * @return false if cancelled while the bus connection was lost
+ *
+ * @throw SdBusError on bus errors other than the connection loss
+ */
+bool watch(Samples& samples, Fetcher& fetcher, double interval,
+           const WatchCallback& callback,
+           const std::function<bool()>& cancelled = nullptr);
+
+} // namespace lssensors
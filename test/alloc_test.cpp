@@ -0,0 +1,186 @@
+#include "alloc-stats.hpp"
+#include "lssensors-private.hpp"
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <systemd/sd-bus.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+using namespace lssensors;
+
+static constexpr auto SERVICE = "xyz.openbmc_project.FakeSensor";
+static constexpr auto SENSORS = "/xyz/openbmc_project/sensors/temperature";
+static constexpr size_t SENSORS_COUNT = 50;
+static constexpr size_t SWEEPS = 10;
+
+// Allocations budgets per sensor in the steady state
+static constexpr double FETCH_BUDGET = 2;
+static constexpr double DECODE_BUDGET = 1;
+static constexpr double FORMAT_BUDGET = 0;
+
+/**
+ * @brief Answer GetAll of any sensor with the canned properties
+ */
+static int onCall(sd_bus_message* m, void*, sd_bus_error*)
+{
+    if (strcmp(sd_bus_message_get_member(m), "GetAll"))
+    {
+        return sd_bus_reply_method_errorf(
+            m, "org.freedesktop.DBus.Error.UnknownMethod", "Unknown method");
+    }
+    return sd_bus_reply_method_return(
+        m, "a{sv}", 15, "Value", "d", 42.5, "MaxValue", "d", 127.0,
+        "MinValue", "d", -128.0, "Unit", "s",
+        "xyz.openbmc_project.Sensor.Value.Unit.DegreesC", "CriticalLow", "d",
+        5.0, "CriticalHigh", "d", 95.0, "WarningLow", "d", 10.0,
+        "WarningHigh", "d", 85.0, "CriticalAlarmLow", "b", 0,
+        "CriticalAlarmHigh", "b", 0, "WarningAlarmLow", "b", 0,
+        "WarningAlarmHigh", "b", 0, "Available", "b", 1, "Functional", "b",
+        1, "Associations", "a(sss)", 0);
+}
+
+/**
+ * @brief Serve the fake sensors on the peer-to-peer connection until it is
+ *        closed
+ */
+static void serve(int fd)
+{
+    sd_bus* conn = nullptr;
+    sd_id128_t id;
+    if (sd_bus_new(&conn) < 0 || sd_id128_randomize(&id) < 0 ||
+        sd_bus_set_fd(conn, fd, fd) < 0 || sd_bus_set_server(conn, 1, id) < 0 ||
+        sd_bus_start(conn) < 0 ||
+        sd_bus_add_fallback(conn, nullptr, SENSORS, onCall, nullptr) < 0)
+    {
+        _exit(EXIT_FAILURE);
+    }
+    while (true)
+    {
+        const int rc = sd_bus_process(conn, nullptr);
+        if (rc < 0 || (rc == 0 && sd_bus_wait(conn, UINT64_MAX) < 0))
+        {
+            _exit(EXIT_SUCCESS);
+        }
+    }
+}
+
+/**
+ * @brief Fetching and formatting of the sensors answered by a fake service
+ */
+class AllocTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        int fds[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds), 0);
+        server = fork();
+        ASSERT_GE(server, 0);
+        if (server == 0)
+        {
+            close(fds[0]);
+            serve(fds[1]);
+        }
+        close(fds[1]);
+
+        sd_bus* conn = nullptr;
+        ASSERT_GE(sd_bus_new(&conn), 0);
+        ASSERT_GE(sd_bus_set_fd(conn, fds[0], fds[0]), 0);
+        ASSERT_GE(sd_bus_start(conn), 0);
+        useBus(conn);
+        sd_bus_unref(conn);
+
+        for (size_t i = 0; i < SENSORS_COUNT; ++i)
+        {
+            Sample sample;
+            sample.path = std::string(SENSORS) + "/T" + std::to_string(i);
+            sample.service = SERVICE;
+            samples.push_back(std::move(sample));
+        }
+    }
+
+    void TearDown() override
+    {
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+    }
+
+    pid_t server = -1;
+    Samples samples;
+};
+
+TEST_F(AllocTest, Fetch)
+{
+    Fetcher::Limits limits;
+    limits.rate = 0;
+    Fetcher fetcher(limits, FetchPriority());
+    // The first sweeps allocate the properties and the limiter state
+    fetcher.fetch(samples);
+    fetcher.fetch(samples);
+    ASSERT_FALSE(fetcher.failed(0));
+
+    const size_t start = allocCount;
+    for (size_t i = 0; i < SWEEPS; ++i)
+    {
+        fetcher.fetch(samples);
+    }
+    const double count =
+        static_cast<double>(allocCount - start) / SWEEPS / SENSORS_COUNT;
+    EXPECT_LE(count, FETCH_BUDGET);
+    EXPECT_EQ(samples[0].props.value(), " 42.500");
+}
+
+TEST_F(AllocTest, Decode)
+{
+    sd_bus_message* reply = nullptr;
+    ASSERT_GE(sd_bus_call_method(bus().get_bus(), SERVICE,
+                                 samples[0].path.c_str(), SYSTEMD_PROPERTIES,
+                                 "GetAll", nullptr, &reply, "s", ""),
+              0);
+    Properties props;
+    ASSERT_GE(decodeProperties(reply, props), 0);
+
+    const size_t start = allocCount;
+    for (size_t i = 0; i < SWEEPS * SENSORS_COUNT; ++i)
+    {
+        sd_bus_message_rewind(reply, 1);
+        decodeProperties(reply, props);
+    }
+    const double count =
+        static_cast<double>(allocCount - start) / SWEEPS / SENSORS_COUNT;
+    EXPECT_LE(count, DECODE_BUDGET);
+    EXPECT_EQ(props.size(), 14u);
+    sd_bus_message_unref(reply);
+}
+
+TEST_F(AllocTest, Format)
+{
+    Fetcher::Limits limits;
+    limits.rate = 0;
+    Fetcher fetcher(limits, FetchPriority());
+    fetcher.fetch(samples);
+
+    size_t length = 0;
+    const size_t start = allocCount;
+    for (size_t i = 0; i < SWEEPS; ++i)
+    {
+        for (const auto& sample : samples)
+        {
+            const Properties& props = sample.props;
+            length += props.value().size() + props.unit().size() +
+                      props.status().size() + props.criticalLow().size() +
+                      props.warningLow().size() + props.warningHigh().size() +
+                      props.criticalHigh().size();
+        }
+    }
+    const double count =
+        static_cast<double>(allocCount - start) / SWEEPS / SENSORS_COUNT;
+    EXPECT_LE(count, FORMAT_BUDGET);
+    EXPECT_GT(length, 0u);
+}
@@ -0,0 +1,69 @@
+#include "histogram.hpp"
+
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+TEST(HistogramTest, Positive)
+{
+    ValueHistogram hist;
+    for (int i = 1; i <= 100; ++i)
+    {
+        hist.add(i);
+    }
+    EXPECT_EQ(hist.count(), 100u);
+    EXPECT_DOUBLE_EQ(hist.minimum(), 1);
+    EXPECT_DOUBLE_EQ(hist.maximum(), 100);
+    EXPECT_DOUBLE_EQ(hist.mean(), 50.5);
+    EXPECT_NEAR(hist.percentile(50), 50, 50 * 0.016);
+    EXPECT_NEAR(hist.percentile(90), 90, 90 * 0.016);
+    EXPECT_DOUBLE_EQ(hist.percentile(100), 100);
+}
+
+TEST(HistogramTest, Negative)
+{
+    ValueHistogram hist;
+    for (int i = 1; i <= 100; ++i)
+    {
+        hist.add(-i);
+    }
+    EXPECT_DOUBLE_EQ(hist.minimum(), -100);
+    EXPECT_DOUBLE_EQ(hist.maximum(), -1);
+    EXPECT_DOUBLE_EQ(hist.mean(), -50.5);
+    EXPECT_NEAR(hist.percentile(10), -91, 91 * 0.016);
+    EXPECT_NEAR(hist.percentile(50), -51, 51 * 0.016);
+    EXPECT_DOUBLE_EQ(hist.percentile(100), -1);
+}
+
+TEST(HistogramTest, Mixed)
+{
+    ValueHistogram hist;
+    for (int i = -50; i < 50; ++i)
+    {
+        hist.add(i + 0.5);
+    }
+    EXPECT_DOUBLE_EQ(hist.minimum(), -49.5);
+    EXPECT_DOUBLE_EQ(hist.maximum(), 49.5);
+    EXPECT_NEAR(hist.percentile(25), -25.5, 25.5 * 0.016);
+    EXPECT_NEAR(hist.percentile(75), 24.5, 24.5 * 0.016);
+    EXPECT_GE(hist.percentile(50), -0.5);
+    EXPECT_LE(hist.percentile(50), 0);
+
+    // Buckets ascend and cover all the values
+    std::vector<std::pair<double, uint64_t>> buckets;
+    hist.forEachBucket([&](double value, uint64_t count) {
+        buckets.emplace_back(value, count);
+    });
+    uint64_t total = 0;
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+        if (i)
+        {
+            EXPECT_LT(buckets[i - 1].first, buckets[i].first);
+        }
+        total += buckets[i].second;
+    }
+    EXPECT_EQ(total, hist.count());
+    EXPECT_LE(buckets.front().first, -49.5);
+}
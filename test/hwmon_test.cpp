@@ -0,0 +1,178 @@
+#include "lssensors-private.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <gtest/gtest.h>
+
+using namespace lssensors;
+
+static constexpr auto SENSORS = "/xyz/openbmc_project/sensors";
+
+/**
+ * @brief Fake hwmon class directory in a temporary directory
+ */
+class HwmonTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/lssensors-hwmon-XXXXXX";
+        ASSERT_NE(mkdtemp(dir), nullptr);
+        root = dir;
+
+        write("hwmon0/temp1_label", "CPU Temp\n");
+        write("hwmon0/temp1_input", "45500\n");
+        write("hwmon0/in0_label", "P12V\n");
+        write("hwmon0/in0_input", "12034\n");
+        write("hwmon0/in1_input", "3300\n");
+        write("hwmon1/fan1_label", "Fan 1\n");
+        write("hwmon1/fan1_input", "");
+        // Same label of another kind
+        write("hwmon1/temp2_label", "P12V\n");
+        write("hwmon1/temp2_input", "30000\n");
+
+        samples = {
+            sample("temperature/CPU_Temp", PropertyValue(int64_t(45000)),
+                   -3),
+            sample("voltage/P12V", PropertyValue(12.0)),
+            sample("voltage/P3V3", PropertyValue(3.3)),
+            sample("fan_tach/Fan_1", PropertyValue(2000.0)),
+            sample("temperature/Other", PropertyValue(20.0)),
+        };
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove_all(root);
+    }
+
+    /**
+     * @brief Create the file under the root
+     */
+    void write(const std::string& file, const std::string& content)
+    {
+        const std::filesystem::path path = root + '/' + file;
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream(path) << content;
+    }
+
+    /**
+     * @brief Make the sensor sample as fetched from the bus
+     */
+    static Sample sample(const std::string& name, PropertyValue value,
+                         int64_t scale = 0)
+    {
+        Sample ret;
+        ret.path = std::string(SENSORS) + '/' + name;
+        ret.service = "xyz.openbmc_project.HwmonTempSensor";
+        ret.props.emplace("Value", value);
+        if (scale)
+        {
+            ret.props.emplace("Scale", PropertyValue(scale));
+        }
+        return ret;
+    }
+
+    std::string root;
+    Samples samples;
+};
+
+TEST_F(HwmonTest, MapByLabel)
+{
+    HwmonReader reader(root);
+    EXPECT_EQ(reader.map(samples, nullptr), 3u);
+    const std::vector<bool> expected = {true, true, false, true, false};
+    EXPECT_EQ(reader.mapped(), expected);
+}
+
+TEST_F(HwmonTest, ReadScaled)
+{
+    HwmonReader reader(root);
+    reader.map(samples, nullptr);
+    reader.read(samples);
+
+    // The integer sensor keeps publishing the value multiplied by 10^3
+    const auto& temp = samples[0].props.at("Value");
+    ASSERT_TRUE(std::holds_alternative<int64_t>(temp));
+    EXPECT_EQ(std::get<int64_t>(temp), 45500);
+    // The scale is applied in single precision
+    EXPECT_NEAR(*samples[0].props.reading(), 45.5, 1e-4);
+
+    // Not the temperature with the same label
+    const auto& volt = samples[1].props.at("Value");
+    ASSERT_TRUE(std::holds_alternative<double>(volt));
+    EXPECT_DOUBLE_EQ(std::get<double>(volt), 12.034);
+
+    // Not mapped ones are left as fetched
+    EXPECT_DOUBLE_EQ(std::get<double>(samples[2].props.at("Value")), 3.3);
+
+    // Unreadable attribute
+    EXPECT_TRUE(std::isnan(std::get<double>(samples[3].props.at("Value"))));
+}
+
+TEST_F(HwmonTest, ReadUpdated)
+{
+    HwmonReader reader(root);
+    reader.map(samples, nullptr);
+    reader.read(samples);
+    write("hwmon0/in0_input", "11950\n");
+    reader.read(samples);
+    EXPECT_DOUBLE_EQ(std::get<double>(samples[1].props.at("Value")), 11.95);
+}
+
+TEST_F(HwmonTest, ReadAlarms)
+{
+    // Scaled thresholds of the integer sensor, stale alarms from the bus
+    Properties& temp = samples[0].props;
+    temp.emplace("WarningHigh", PropertyValue(int64_t(45000)));
+    temp.emplace("CriticalHigh", PropertyValue(int64_t(50000)));
+    temp.emplace("WarningAlarmHigh", PropertyValue(false));
+    temp.emplace("CriticalAlarmHigh", PropertyValue(true));
+    Properties& volt = samples[1].props;
+    volt.emplace("WarningLow", PropertyValue(11.4));
+    volt.emplace("WarningAlarmLow", PropertyValue(false));
+
+    HwmonReader reader(root);
+    reader.map(samples, nullptr);
+    reader.read(samples);
+    EXPECT_EQ(temp.state(), Status::warning);
+    EXPECT_FALSE(std::get<bool>(temp.at("CriticalAlarmHigh")));
+    EXPECT_EQ(volt.state(), Status::ok);
+
+    write("hwmon0/in0_input", "11350\n");
+    reader.read(samples);
+    EXPECT_EQ(volt.state(), Status::warning);
+}
+
+TEST_F(HwmonTest, MapByConfig)
+{
+    write("map.conf", "# sensor attribute\n"
+                      "P3V3   hwmon0/in1_input\n"
+                      "\n" +
+                          std::string(SENSORS) +
+                          "/temperature/Other hwmon1/temp2_input # comment\n");
+    HwmonReader reader(root);
+    EXPECT_EQ(reader.map(samples, (root + "/map.conf").c_str()), 2u);
+    const std::vector<bool> expected = {false, false, true, false, true};
+    EXPECT_EQ(reader.mapped(), expected);
+
+    reader.read(samples);
+    EXPECT_DOUBLE_EQ(std::get<double>(samples[2].props.at("Value")), 3.3);
+    EXPECT_DOUBLE_EQ(std::get<double>(samples[4].props.at("Value")), 30.0);
+}
+
+TEST_F(HwmonTest, BadConfig)
+{
+    HwmonReader reader(root);
+    EXPECT_THROW(reader.map(samples, (root + "/missing.conf").c_str()),
+                 std::runtime_error);
+
+    write("bad.conf", "P3V3\n");
+    EXPECT_THROW(reader.map(samples, (root + "/bad.conf").c_str()),
+                 std::runtime_error);
+}